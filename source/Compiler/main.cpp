@@ -2,6 +2,290 @@
 #include "xgeom_static_compiler.h"
 #include "dependencies/xscheduler/source/xscheduler.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+    #include <io.h>
+#else
+    #include <unistd.h>
+#endif
+
+//---------------------------------------------------------------------------------------
+// Batch mode. Instead of one process per descriptor the compiler can be handed a list of
+// them, either as a file or streamed through stdin, and compiles them with a single
+// scheduler. The shared arguments (-PROJECT, -OUTPUT, -DEBUG, ...) are given once on the
+// command line and every line of the list is a descriptor path:
+//
+//      -BATCH <ListFile>   Compiles every descriptor listed in the file
+//      -BATCH -            Reads descriptors from stdin as they arrive (server mode),
+//                          an empty line or QUIT ends the session
+//      -JOBS  <Count>      How many descriptors compile at the same time
+//
+// Every descriptor gets its own compiler instance so a failure (or exception) only fails
+// that job. As soon as a job finishes one line is written to stdout:
+//
+//      RESULT <Index> OK <Milliseconds> <Descriptor>
+//      RESULT <Index> FAILED <Milliseconds> <Descriptor> : <Error>
+//
+// stdout only carries those lines. Everything else the jobs print (warnings, progress) is
+// moved to stderr for the whole session so a client can parse stdout line by line.
+//---------------------------------------------------------------------------------------
+
+namespace
+{
+    struct batch_settings
+    {
+        std::vector<const char*>    m_SharedArgs;
+        std::string                 m_ListFile;
+        int                         m_nJobs     = 0;
+        bool                        m_bBatch    = false;
+    };
+
+    //---------------------------------------------------------------------------------------
+
+    std::string ErrorToString(xerr Err)
+    {
+        std::string String;
+        Err.ForEachInChain([&](xerr Error)
+        {
+            if (not String.empty()) String += " | ";
+            String += Error.getMessage();
+            if (auto Hint = Error.getHint(); Hint.empty() == false)
+                String += std::format(" (Hint: {})", Hint);
+        });
+        return String;
+    }
+
+    //---------------------------------------------------------------------------------------
+
+    void PrintError(xerr Err)
+    {
+        Err.ForEachInChain([&](xerr Error)
+        {
+            auto Hint = Error.getHint();
+            auto String = std::format("Error: {}\n", Error.getMessage());
+            printf("%s", String.c_str());
+            if (Hint.empty() == false)
+                printf("Hint: %.*s\n", static_cast<int>(Hint.size()), Hint.data());
+        });
+    }
+
+    //---------------------------------------------------------------------------------------
+    // Pulls the batch options out of the command line, the rest is handed to every job
+
+    batch_settings ParseBatchArgs(int argc, const char* argv[])
+    {
+        batch_settings Settings;
+        for (int i = 0; i < argc; ++i)
+        {
+            if (i + 1 < argc && std::strcmp(argv[i], "-BATCH") == 0)
+            {
+                Settings.m_bBatch   = true;
+                Settings.m_ListFile = argv[++i];
+            }
+            else if (i + 1 < argc && std::strcmp(argv[i], "-JOBS") == 0)
+            {
+                Settings.m_nJobs = std::max(1, std::atoi(argv[++i]));
+            }
+            else
+            {
+                Settings.m_SharedArgs.push_back(argv[i]);
+            }
+        }
+
+        // The compiles already spread their own work across the scheduler, a few of them
+        // at the same time is enough to hide the serial parts (import, serialization)
+        if (Settings.m_nJobs == 0) Settings.m_nJobs = static_cast<int>(std::clamp(std::thread::hardware_concurrency() / 4u, 1u, 8u));
+
+        return Settings;
+    }
+
+    //---------------------------------------------------------------------------------------
+    // Queue between the reader (file or stdin) and the compile workers
+
+    class job_queue
+    {
+    public:
+
+        struct job
+        {
+            std::size_t     m_Index;
+            std::string     m_Descriptor;
+        };
+
+        void Push(std::string Descriptor)
+        {
+            {
+                std::lock_guard Lock(m_Lock);
+                m_Jobs.push_back({ m_nPushed++, std::move(Descriptor) });
+            }
+            m_Signal.notify_one();
+        }
+
+        void Close()
+        {
+            {
+                std::lock_guard Lock(m_Lock);
+                m_bClosed = true;
+            }
+            m_Signal.notify_all();
+        }
+
+        std::optional<job> Pop()
+        {
+            std::unique_lock Lock(m_Lock);
+            m_Signal.wait(Lock, [&] { return m_bClosed || not m_Jobs.empty(); });
+            if (m_Jobs.empty()) return std::nullopt;
+
+            auto Job = std::move(m_Jobs.front());
+            m_Jobs.pop_front();
+            return Job;
+        }
+
+    private:
+
+        std::mutex              m_Lock;
+        std::condition_variable m_Signal;
+        std::deque<job>         m_Jobs;
+        std::size_t             m_nPushed = 0;
+        bool                    m_bClosed = false;
+    };
+
+    //---------------------------------------------------------------------------------------
+    // Compiles a single descriptor with its own instance, nothing escapes from here
+
+    std::string CompileDescriptor(const batch_settings& Settings, const std::string& Descriptor)
+    {
+        try
+        {
+            auto Args = Settings.m_SharedArgs;
+            Args.push_back("-DESCRIPTOR");
+            Args.push_back(Descriptor.c_str());
+
+            auto GeomCompilerPipeline = xgeom_static_compiler::instance::Create();
+
+            if (auto Err = GeomCompilerPipeline->Parse(static_cast<int>(Args.size()), Args.data()); Err)
+                return ErrorToString(Err);
+
+            if (auto Err = GeomCompilerPipeline->Compile(); Err)
+                return ErrorToString(Err);
+        }
+        catch (const std::exception& Exception)
+        {
+            return std::format("Exception thrown: {}", Exception.what());
+        }
+        catch (...)
+        {
+            return "Unknown exception thrown";
+        }
+
+        return {};
+    }
+
+    //---------------------------------------------------------------------------------------
+    // Keeps the real stdout for the protocol and points the process stdout at stderr, so
+    // whatever the jobs print can not end up in the middle of a RESULT line
+
+    FILE* SplitResultsStream()
+    {
+        std::fflush(stdout);
+
+    #if defined(_WIN32)
+        const int ResultsFD = _dup(_fileno(stdout));
+        FILE*     pResults  = (ResultsFD != -1) ? _fdopen(ResultsFD, "w") : nullptr;
+        if (pResults) _dup2(_fileno(stderr), _fileno(stdout));
+    #else
+        const int ResultsFD = dup(fileno(stdout));
+        FILE*     pResults  = (ResultsFD != -1) ? fdopen(ResultsFD, "w") : nullptr;
+        if (pResults) dup2(fileno(stderr), fileno(stdout));
+    #endif
+
+        return pResults ? pResults : stdout;
+    }
+
+    //---------------------------------------------------------------------------------------
+
+    int RunBatch(const batch_settings& Settings)
+    {
+        FILE* const             pResults = SplitResultsStream();
+        job_queue               Queue;
+        std::mutex              OutputLock;
+        std::atomic<int>        nFailed{ 0 };
+        std::vector<std::thread> Workers;
+
+        for (int i = 0; i < Settings.m_nJobs; ++i)
+        {
+            Workers.emplace_back([&]
+            {
+                while (auto Job = Queue.Pop())
+                {
+                    const auto Start = std::chrono::steady_clock::now();
+                    const auto Error = CompileDescriptor(Settings, Job->m_Descriptor);
+                    const auto MS    = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - Start).count();
+
+                    if (not Error.empty()) nFailed.fetch_add(1, std::memory_order_relaxed);
+
+                    std::lock_guard Lock(OutputLock);
+                    if (Error.empty()) std::fprintf(pResults, "RESULT %zu OK %lld %s\n", Job->m_Index, static_cast<long long>(MS), Job->m_Descriptor.c_str());
+                    else               std::fprintf(pResults, "RESULT %zu FAILED %lld %s : %s\n", Job->m_Index, static_cast<long long>(MS), Job->m_Descriptor.c_str(), Error.c_str());
+                    std::fflush(pResults);
+                }
+            });
+        }
+
+        //
+        // Feed the queue
+        //
+        auto ReadList = [&](std::istream& Stream, bool bServer)
+        {
+            std::string Line;
+            while (std::getline(Stream, Line))
+            {
+                while (not Line.empty() && (Line.back() == '\r' || Line.back() == ' ')) Line.pop_back();
+                if (Line.empty() || Line == "QUIT")
+                {
+                    if (bServer) break;
+                    continue;
+                }
+                Queue.Push(std::move(Line));
+            }
+        };
+
+        int Result = 0;
+        if (Settings.m_ListFile == "-")
+        {
+            ReadList(std::cin, true);
+        }
+        else if (std::ifstream File(Settings.m_ListFile); File)
+        {
+            ReadList(File, false);
+        }
+        else
+        {
+            std::fprintf(stderr, "Error: Unable to open the batch list %s\n", Settings.m_ListFile.c_str());
+            Result = 1;
+        }
+
+        Queue.Close();
+        for (auto& W : Workers) W.join();
+
+        return (Result || nFailed.load()) ? 1 : 0;
+    }
+}
+
 //---------------------------------------------------------------------------------------
 
 int main( int argc, const char* argv[] )
@@ -11,11 +295,6 @@ int main( int argc, const char* argv[] )
     //
     xscheduler::g_System.Init();
 
-    //
-   // Create the compiler instance
-   //
-    auto GeomCompilerPipeline = xgeom_static_compiler::instance::Create();
-
     //
     // This is just for debugging
     //
@@ -37,19 +316,23 @@ int main( int argc, const char* argv[] )
         argc = static_cast<int>(sizeof(pDebugArgs) / sizeof(pDebugArgs[0]));
     }
 
+    //
+    // Many descriptors in one process
+    //
+    if (auto Settings = ParseBatchArgs(argc, argv); Settings.m_bBatch)
+        return RunBatch(Settings);
+
+    //
+   // Create the compiler instance
+   //
+    auto GeomCompilerPipeline = xgeom_static_compiler::instance::Create();
+
     //
     // Parse parameters
     //
     if (auto Err = GeomCompilerPipeline->Parse(argc, argv); Err)
     {
-        Err.ForEachInChain([&](xerr Error)
-        {
-            auto Hint = Err.getHint();
-            auto String = std::format("Error: {}\n", Err.getMessage());
-            printf("%s", String.c_str());
-            if (Hint.empty() == false)
-                printf("Hint: %s\n", Hint.data());
-        });
+        PrintError(Err);
         return 1;
     }
 
@@ -58,18 +341,10 @@ int main( int argc, const char* argv[] )
     //
     if (auto Err = GeomCompilerPipeline->Compile(); Err)
     {
-        Err.ForEachInChain([&](xerr Error)
-        {
-            auto Hint = Err.getHint();
-            auto String = std::format("Error: {}\n", Err.getMessage());
-            printf("%s", String.c_str());
-            if (Hint.empty() == false)
-                printf("Hint: %s\n", Hint.data());
-        });
+        PrintError(Err);
         return 1;
     }
 
 
     return 0;
 }
-
@@ -4,14 +4,17 @@
 
 #include "dependencies/xraw3d/source/xraw3d.h"
 #include "dependencies/xraw3d/source/details/xraw3d_assimp_import_v3.h"
+#include <assimp/version.h>
 
 #include "dependencies/meshoptimizer/src/meshoptimizer.h"
 #include "dependencies/xbitmap/source/xcolor.h"
 #include "dependencies/xbits/source/xbits.h"
+#include "dependencies/xscheduler/source/xscheduler.h"
 
 #include "../xgeom_static_descriptor.h"
 #include "../xgeom_static.h"
 #include "../xgeom_static_details.h"
+#include "xgeom_static_compiler_profiler.h"
 
 #include "dependencies/xproperty/source/xcore/my_properties.cpp"
 #include "dependencies/xmath/source/bridge/xmath_to_xproperty.h"
@@ -21,6 +24,26 @@
 #include <algorithm>
 #include <unordered_set>
 #include <iostream>
+#include <atomic>
+#include <fstream>
+#include <filesystem>
+#include <chrono>
+#include <functional>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <exception>
+#include <optional>
+#include <array>
+#include <sstream>
+#include <cctype>
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__)
+    #include <immintrin.h>
+    #define XGEOM_STATIC_COMPILER_SSE 1
+#else
+    #define XGEOM_STATIC_COMPILER_SSE 0
+#endif
 
 namespace xgeom_static_compiler
 {
@@ -28,14 +51,50 @@ namespace xgeom_static_compiler
     {
         using geom = xgeom_static::geom;
 
-        struct vertex
-        { 
-            xmath::fvec3                    m_Position;
-            std::array<xmath::fvec2, 4>     m_UVs;
-            xcolori                         m_Color;
-            xmath::fvec3                    m_Normal;
-            xmath::fvec3                    m_Tangent;
-            xmath::fvec3                    m_Binormal;
+        //--------------------------------------------------------------------------------------
+        // Compiler vertices are stored one array per attribute so the position only passes
+        // (simplification, clustering, stats) walk a dense array. Only the attributes that
+        // the submesh has are allocated: the UV sets up to m_nUVs, the rest only when some
+        // vertex carried them. The binormal is only ever needed as the handedness of
+        // cross(N, T) so that is all that is kept.
+
+        struct vertex_streams
+        {
+            std::vector<xmath::fvec3>                   m_Position;
+            std::array<std::vector<xmath::fvec2>, 4>    m_UVs;
+            std::vector<xcolori>                        m_Color;
+            std::vector<xmath::fvec3>                   m_Normal;
+            std::vector<xmath::fvec3>                   m_Tangent;
+            std::vector<std::int8_t>                    m_BinormalSign;
+
+            std::size_t     size            (void)                      const noexcept { return m_Position.size(); }
+            bool            empty           (void)                      const noexcept { return m_Position.empty(); }
+            xmath::fvec2    getUV           (std::size_t i)             const noexcept { return m_UVs[0].empty()  ? xmath::fvec2(0.0f, 0.0f) : m_UVs[0][i]; }
+            xmath::fvec3    getNormal       (std::size_t i)             const noexcept { return m_Normal.empty()  ? xmath::fvec3::fromZero() : m_Normal[i]; }
+            xmath::fvec3    getTangent      (std::size_t i)             const noexcept { return m_Tangent.empty() ? xmath::fvec3::fromZero() : m_Tangent[i]; }
+            float           getBinormalSign (std::size_t i)             const noexcept { return (m_BinormalSign.empty() || m_BinormalSign[i] >= 0) ? 1.0f : -1.0f; }
+            const float*    getPositions    (void)                      const noexcept { return &m_Position[0].m_X; }
+
+            // Optional streams start with the first vertex that has them, this pads them
+            // to the full vertex count once the submesh is complete
+            void Finish(void) noexcept
+            {
+                const auto n = size();
+                for (auto& UV : m_UVs) if (not UV.empty()) UV.resize(n, xmath::fvec2(0.0f, 0.0f));
+                if (not m_Color.empty())        m_Color.resize(n);
+                if (not m_Normal.empty())       m_Normal.resize(n, xmath::fvec3::fromZero());
+                if (not m_Tangent.empty())      m_Tangent.resize(n, xmath::fvec3::fromZero());
+                if (not m_BinormalSign.empty()) m_BinormalSign.resize(n, 1);
+            }
+
+            std::size_t getMemorySize(void) const noexcept
+            {
+                std::size_t Bytes = m_Position.size() * sizeof(xmath::fvec3) + m_Color.size() * sizeof(xcolori) + (m_Normal.size() + m_Tangent.size()) * sizeof(xmath::fvec3) + m_BinormalSign.size();
+                for (const auto& UV : m_UVs) Bytes += UV.size() * sizeof(xmath::fvec2);
+                return Bytes;
+            }
+
+            inline static constexpr std::size_t position_stride_v = sizeof(xmath::fvec3);
         };
 
         struct lod
@@ -46,7 +105,7 @@ namespace xgeom_static_compiler
 
         struct sub_mesh
         {
-            std::vector<vertex>             m_Vertex;
+            vertex_streams                  m_Vertex;
             std::vector<std::uint32_t>      m_Indices;                      // Actual LOD 0 (Original mesh)
             std::vector<lod>                m_LODs;                         // This is LOD 1..n (New computed LODS)
             std::uint32_t                   m_iMaterial;
@@ -70,6 +129,272 @@ namespace xgeom_static_compiler
             m_FinalGeom.Initialize();
         }
 
+        ~implementation()
+        {
+            m_FinalGeom.Kill();
+        }
+
+        //--------------------------------------------------------------------------------------
+        // Import snapshot. Importing through assimp is by far the slowest part of a compile
+        // and it only depends on the source file and the import settings, so the imported
+        // xraw3d::geom and node tree are dumped in binary next to the logs and reloaded when
+        // the content hash of the source still matches. Only what the compiler reads is kept:
+        // vertices and facets as is, mesh names/paths/bone counts, material instance names and
+        // the node names/mesh lists.
+
+        inline static constexpr std::uint64_t   snapshot_magic_v    = 0x58474D534E415031ull;
+        inline static constexpr std::uint32_t   snapshot_version_v  = 1;
+
+        using raw_vertex = decltype(xraw3d::geom::m_Vertex)::value_type;
+        using raw_facet  = decltype(xraw3d::geom::m_Facet)::value_type;
+        static_assert(std::is_trivially_copyable_v<raw_vertex>);
+        static_assert(std::is_trivially_copyable_v<raw_facet>);
+
+        //--------------------------------------------------------------------------------------
+        // 64 bit FNV-1a style hash, words at a time so hashing a few GB stays cheap
+
+        static std::uint64_t HashBytes(const void* pData, std::size_t Size, std::uint64_t Hash = 0xcbf29ce484222325ull) noexcept
+        {
+            constexpr std::uint64_t prime_v = 0x100000001b3ull;
+            const auto*             pBytes  = static_cast<const std::uint8_t*>(pData);
+            std::size_t             i       = 0;
+
+            for (; i + 8 <= Size; i += 8)
+            {
+                std::uint64_t Word;
+                std::memcpy(&Word, pBytes + i, sizeof(Word));
+                Hash = (Hash ^ Word) * prime_v;
+            }
+            for (; i < Size; ++i) Hash = (Hash ^ pBytes[i]) * prime_v;
+
+            return Hash;
+        }
+
+        //--------------------------------------------------------------------------------------
+
+        static bool HashFile(const std::filesystem::path& Path, std::uint64_t& Hash) noexcept
+        {
+            std::ifstream File(Path, std::ios::binary);
+            if (not File) return false;
+
+            std::vector<char> Buffer(1 << 20);
+            while (File)
+            {
+                File.read(Buffer.data(), Buffer.size());
+                Hash = HashBytes(Buffer.data(), static_cast<std::size_t>(File.gcount()), Hash);
+            }
+            return true;
+        }
+
+        //--------------------------------------------------------------------------------------
+        // Files that the importer opens next to the source and that change the geometry: the
+        // buffers of a .gltf and the material libraries of an .obj (material names). Formats
+        // that keep everything in one file return an empty list. Any other format may pull in
+        // files we do not know about so it gets no snapshot at all (returns false).
+
+        static bool getImportDependencies(const std::filesystem::path& Path, std::vector<std::filesystem::path>& Dependencies) noexcept
+        {
+            auto Ext = Path.extension().string();
+            std::ranges::transform(Ext, Ext.begin(), [](char c) { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+
+            constexpr std::array single_file_v = { ".fbx", ".glb", ".ply", ".stl", ".3ds", ".blend" };
+            if (std::ranges::find(single_file_v, Ext) != single_file_v.end()) return true;
+
+            const auto      Folder = Path.parent_path();
+            std::ifstream   File(Path, std::ios::binary);
+            if (not File) return false;
+
+            if (Ext == ".gltf")
+            {
+                const std::string Text((std::istreambuf_iterator<char>(File)), std::istreambuf_iterator<char>());
+
+                // Only the "uri" entries inside the "buffers" array, images do not change the geometry
+                auto iBuffers = Text.find("\"buffers\"");
+                if (iBuffers == std::string::npos) return true;
+                auto iBegin = Text.find('[', iBuffers);
+                if (iBegin == std::string::npos) return false;
+
+                std::size_t iEnd = iBegin;
+                for (int Depth = 0; iEnd < Text.size(); ++iEnd)
+                {
+                    if (Text[iEnd] == '[') ++Depth;
+                    else if (Text[iEnd] == ']' && --Depth == 0) break;
+                }
+
+                for (auto i = Text.find("\"uri\"", iBegin); i < iEnd; i = Text.find("\"uri\"", i + 5))
+                {
+                    const auto iOpen  = Text.find('"', Text.find(':', i + 5));
+                    const auto iClose = Text.find('"', iOpen + 1);
+                    if (iOpen == std::string::npos || iClose == std::string::npos) return false;
+
+                    const auto Uri = Text.substr(iOpen + 1, iClose - iOpen - 1);
+                    if (Uri.starts_with("data:")) continue;     // Embedded, already hashed with the .gltf
+                    if (Uri.find('%') != std::string::npos) return false;
+                    Dependencies.push_back(Folder / Uri);
+                }
+                return true;
+            }
+
+            if (Ext == ".obj")
+            {
+                std::string Line;
+                while (std::getline(File, Line))
+                {
+                    if (not Line.starts_with("mtllib")) continue;
+
+                    std::istringstream Names(Line.substr(6));
+                    for (std::string Name; Names >> Name; ) Dependencies.push_back(Folder / Name);
+                }
+                return true;
+            }
+
+            return false;
+        }
+
+        //--------------------------------------------------------------------------------------
+        // The key covers the source and the files it pulls in, the import settings and the
+        // importer itself: the assimp version/revision and the build of this compiler (the
+        // xraw3d importer is compiled into it), so updating either one misses.
+
+        static bool ComputeImportKey(const std::wstring_view Path, const xraw3d::assimp_v3::importer::settings& Settings, std::uint64_t& Key) noexcept
+        {
+            std::uint64_t Hash = HashBytes(&snapshot_version_v, sizeof(snapshot_version_v));
+
+            const std::array<unsigned, 4> AssimpVersion = { aiGetVersionMajor(), aiGetVersionMinor(), aiGetVersionPatch(), aiGetVersionRevision() };
+            constexpr std::string_view    CompilerBuild = __DATE__ " " __TIME__;
+            Hash = HashBytes(AssimpVersion.data(), sizeof(AssimpVersion), Hash);
+            Hash = HashBytes(CompilerBuild.data(), CompilerBuild.size(), Hash);
+
+            const std::filesystem::path         SourcePath(Path);
+            std::vector<std::filesystem::path>  Dependencies;
+            if (not getImportDependencies(SourcePath, Dependencies)) return false;
+            if (not HashFile(SourcePath, Hash)) return false;
+
+            for (const auto& D : Dependencies)
+            {
+                const auto Name = D.filename().u8string();
+                Hash = HashBytes(Name.data(), Name.size(), Hash);
+                if (not HashFile(D, Hash)) return false;
+            }
+
+            // Settings that change the result of the import
+            Hash = HashBytes(&Settings.m_bStaticGeometry, sizeof(Settings.m_bStaticGeometry), Hash);
+
+            Key = Hash;
+            return true;
+        }
+
+        //--------------------------------------------------------------------------------------
+
+        struct snapshot_writer
+        {
+            std::ofstream m_File;
+
+            template<typename T> void Value(const T& V)                 { static_assert(std::is_trivially_copyable_v<T>); m_File.write(reinterpret_cast<const char*>(&V), sizeof(T)); }
+            template<typename T> void Array(const std::vector<T>& V)    { Value(static_cast<std::uint64_t>(V.size())); m_File.write(reinterpret_cast<const char*>(V.data()), V.size() * sizeof(T)); }
+            void                      String(const std::string& S)      { Value(static_cast<std::uint64_t>(S.size())); m_File.write(S.data(), S.size()); }
+        };
+
+        struct snapshot_reader
+        {
+            std::ifstream m_File;
+
+            template<typename T> bool Value(T& V)                       { static_assert(std::is_trivially_copyable_v<T>); return !!m_File.read(reinterpret_cast<char*>(&V), sizeof(T)); }
+            template<typename T> bool Array(std::vector<T>& V)          { std::uint64_t n; if (not Value(n)) return false; V.resize(n); return !!m_File.read(reinterpret_cast<char*>(V.data()), n * sizeof(T)); }
+            bool                      String(std::string& S)            { std::uint64_t n; if (not Value(n)) return false; S.resize(n); return !!m_File.read(S.data(), n); }
+        };
+
+        //--------------------------------------------------------------------------------------
+
+        void SaveImportSnapshot(const std::wstring& FileName, std::uint64_t Key, double ImportSeconds) const noexcept
+        {
+            snapshot_writer W{ std::ofstream(std::filesystem::path(FileName), std::ios::binary | std::ios::trunc) };
+            if (not W.m_File) return;
+
+            W.Value(snapshot_magic_v);
+            W.Value(snapshot_version_v);
+            W.Value(Key);
+            W.Value(ImportSeconds);
+
+            W.Array(m_RawGeom.m_Vertex);
+            W.Array(m_RawGeom.m_Facet);
+
+            W.Value(static_cast<std::uint64_t>(m_RawGeom.m_Mesh.size()));
+            for (const auto& M : m_RawGeom.m_Mesh)
+            {
+                W.String(M.m_Name);
+                W.String(M.m_ScenePath);
+                W.Value(M.m_nBones);
+            }
+
+            W.Value(static_cast<std::uint64_t>(m_RawGeom.m_MaterialInstance.size()));
+            for (const auto& E : m_RawGeom.m_MaterialInstance)
+                W.String(E.m_Name);
+
+            std::function<void(const xraw3d::assimp_v3::node&)> WriteNode = [&](const xraw3d::assimp_v3::node& Node)
+            {
+                W.String(Node.m_Name);
+                W.Value(static_cast<std::uint64_t>(Node.m_MeshList.size()));
+                for (const auto& E : Node.m_MeshList) W.Value(static_cast<std::uint64_t>(E));
+                W.Value(static_cast<std::uint64_t>(Node.m_Children.size()));
+                for (const auto& C : Node.m_Children) WriteNode(C);
+            };
+            WriteNode(m_RootNode);
+        }
+
+        //--------------------------------------------------------------------------------------
+
+        bool LoadImportSnapshot(const std::wstring& FileName, std::uint64_t Key, double& ImportSeconds) noexcept
+        {
+            snapshot_reader R{ std::ifstream(std::filesystem::path(FileName), std::ios::binary) };
+            if (not R.m_File) return false;
+
+            std::uint64_t Magic = 0, FileKey = 0;
+            std::uint32_t Version = 0;
+            if (not (R.Value(Magic) && R.Value(Version) && R.Value(FileKey) && R.Value(ImportSeconds))) return false;
+            if (Magic != snapshot_magic_v || Version != snapshot_version_v || FileKey != Key) return false;
+
+            bool          bOK = R.Array(m_RawGeom.m_Vertex) && R.Array(m_RawGeom.m_Facet);
+            std::uint64_t Count = 0;
+
+            bOK = bOK && R.Value(Count);
+            for (std::uint64_t i = 0; bOK && i < Count; ++i)
+            {
+                auto& M = m_RawGeom.m_Mesh.emplace_back();
+                bOK = R.String(M.m_Name) && R.String(M.m_ScenePath) && R.Value(M.m_nBones);
+            }
+
+            bOK = bOK && R.Value(Count);
+            for (std::uint64_t i = 0; bOK && i < Count; ++i)
+                bOK = R.String(m_RawGeom.m_MaterialInstance.emplace_back().m_Name);
+
+            std::function<bool(xraw3d::assimp_v3::node&)> ReadNode = [&](xraw3d::assimp_v3::node& Node) -> bool
+            {
+                std::uint64_t n = 0;
+                if (not (R.String(Node.m_Name) && R.Value(n))) return false;
+                for (std::uint64_t i = 0; i < n; ++i)
+                {
+                    std::uint64_t E;
+                    if (not R.Value(E)) return false;
+                    Node.m_MeshList.emplace_back(static_cast<std::ranges::range_value_t<decltype(Node.m_MeshList)>>(E));
+                }
+
+                if (not R.Value(n)) return false;
+                for (std::uint64_t i = 0; i < n; ++i)
+                    if (not ReadNode(Node.m_Children.emplace_back())) return false;
+                return true;
+            };
+            bOK = bOK && ReadNode(m_RootNode);
+
+            if (not bOK)
+            {
+                m_RawGeom  = {};
+                m_RootNode = {};
+            }
+
+            return bOK;
+        }
+
         //--------------------------------------------------------------------------------------
 
         xerr LoadRaw( const std::wstring_view Path )
@@ -81,9 +406,30 @@ namespace xgeom_static_compiler
             Settings.m_pGeom = &m_RawGeom;
             Settings.m_pNode = &m_RootNode;
 
+            const std::wstring  SnapshotPath    = std::format(L"{}\\ImportSnapshot.bin", m_ResourceLogPath);
+            std::uint64_t       Key             = 0;
+            const bool          bHasKey         = ComputeImportKey(Path, Settings, Key);
+            const auto          Start           = std::chrono::steady_clock::now();     // Hashing the source is paid either way
+            auto                Seconds         = [&] { return std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count(); };
+
+            if (not bHasKey)
+                LogMessage(xresource_pipeline::msg_type::INFO, "Import snapshot disabled, the source format may depend on files that are not tracked");
+
+            if (double ImportSeconds = 0; bHasKey && LoadImportSnapshot(SnapshotPath, Key, ImportSeconds))
+            {
+                const double LoadSeconds = Seconds();
+                LogMessage(xresource_pipeline::msg_type::INFO, std::format("Import snapshot hit: loaded in {:.2f}s, {:.2f}s saved", LoadSeconds, ImportSeconds - LoadSeconds));
+                return {};
+            }
+
             if ( auto Err = Importer.Import(Path, Settings); Err )
                 return xerr::create_f<state, "Failed to import the asset">(Err);
 
+            const double ImportSeconds = Seconds();
+            LogMessage(xresource_pipeline::msg_type::INFO, std::format("Import snapshot miss: imported in {:.2f}s", ImportSeconds));
+
+            if (bHasKey) SaveImportSnapshot(SnapshotPath, Key, ImportSeconds);
+
             return {};
         }
 
@@ -194,106 +540,250 @@ namespace xgeom_static_compiler
         }
 */
 
-void ConvertToCompilerMesh(void)
-{
-    for (auto& Mesh : m_RawGeom.m_Mesh)
-    {
-        auto& NewMesh = m_CompilerMesh.emplace_back();
-        NewMesh.m_Name = Mesh.m_Name;
-    }
+        //--------------------------------------------------------------------------------------
+        // Builds the compiler meshes from the raw geom. The facets are sorted by mesh, material
+        // and bone so every mesh is a contiguous range of facets and every submesh a contiguous
+        // run of one material inside of it. Each mesh is converted by its own job with a remap
+        // table that only spans the raw vertices it references, and between submeshes only
+        // the entries that were touched get reset.
 
-    std::vector<std::int32_t> GeomToCompilerVertMesh(m_RawGeom.m_Vertex.size(), -1);
-    std::vector<std::int32_t> MaterialToSubmesh(m_RawGeom.m_MaterialInstance.size(), -1);
+        void ConvertToCompilerMesh(void)
+        {
+            struct facet_range
+            {
+                std::size_t     m_Begin = 0;
+                std::size_t     m_End   = 0;
+            };
 
-    int CurMaterial = -1;
-    int LastMesh = -1;
+            const auto&                 Facets = m_RawGeom.m_Facet;
+            std::vector<facet_range>    MeshRanges(m_RawGeom.m_Mesh.size());
 
-    for (auto& Face : m_RawGeom.m_Facet)
-    {
-        auto& Mesh = m_CompilerMesh[Face.m_iMesh];
+            for (auto& Mesh : m_RawGeom.m_Mesh)
+            {
+                auto& NewMesh = m_CompilerMesh.emplace_back();
+                NewMesh.m_Name = Mesh.m_Name;
+            }
 
-        // Make sure all faces are sorted by the mesh
-        assert(Face.m_iMesh >= LastMesh);
-        LastMesh = Face.m_iMesh;
+            //
+            // Find the facet range of each mesh
+            //
+            for (std::size_t iBegin = 0; iBegin < Facets.size(); )
+            {
+                const auto  iMesh = Facets[iBegin].m_iMesh;
+                std::size_t iEnd  = iBegin + 1;
+                while (iEnd < Facets.size() && Facets[iEnd].m_iMesh == iMesh) ++iEnd;
+
+                // Make sure all faces are sorted by the mesh
+                assert(MeshRanges[iMesh].m_End == 0);
+                MeshRanges[iMesh] = { iBegin, iEnd };
+                iBegin = iEnd;
+            }
 
-        // are we dealing with a new mesh? if so we need to reset the remap of the submesh
-        if (Mesh.m_SubMesh.size() == 0)
-        {
-            std::fill(MaterialToSubmesh.begin(), MaterialToSubmesh.end(), -1);
-        }
+            std::atomic<bool> bDontShowAgain = false;
 
-        // are we dealing with a new submesh? if so we need to reset the verts
-        if (MaterialToSubmesh[Face.m_iMaterialInstance] == -1)
-        {
-            MaterialToSubmesh[Face.m_iMaterialInstance] = int(Mesh.m_SubMesh.size());
-            auto& Submesh = Mesh.m_SubMesh.emplace_back();
+            ParallelFor(MeshRanges.size(), [&](std::size_t iMesh)
+            {
+                const auto  Range = MeshRanges[iMesh];
+                auto&       Mesh  = m_CompilerMesh[iMesh];
 
-            Submesh.m_iMaterial = Face.m_iMaterialInstance;
+                if (Range.m_Begin == Range.m_End) return;
 
-            std::fill(GeomToCompilerVertMesh.begin(), GeomToCompilerVertMesh.end(), -1);
+                // Remap table only as big as the vertices referenced by this mesh
+                std::uint32_t MinVert = std::numeric_limits<std::uint32_t>::max();
+                std::uint32_t MaxVert = 0;
+                for (std::size_t f = Range.m_Begin; f < Range.m_End; ++f)
+                {
+                    for (int i = 0; i < 3; ++i)
+                    {
+                        MinVert = std::min(MinVert, static_cast<std::uint32_t>(Facets[f].m_iVertex[i]));
+                        MaxVert = std::max(MaxVert, static_cast<std::uint32_t>(Facets[f].m_iVertex[i]));
+                    }
+                }
 
-            CurMaterial = Face.m_iMaterialInstance;
-        }
-        else
-        {
-            // Make sure that faces are sorted by materials
-            assert(CurMaterial >= Face.m_iMaterialInstance);
-        }
+                std::vector<std::int32_t>   GeomToCompilerVert(MaxVert - MinVert + 1, -1);
+                std::vector<std::uint32_t>  TouchedVerts;
 
-        auto& SubMesh = Mesh.m_SubMesh[MaterialToSubmesh[Face.m_iMaterialInstance]];
+                for (std::size_t iBegin = Range.m_Begin; iBegin < Range.m_End; )
+                {
+                    const auto  iMaterial = Facets[iBegin].m_iMaterialInstance;
+                    std::size_t iEnd      = iBegin + 1;
+                    while (iEnd < Range.m_End && Facets[iEnd].m_iMaterialInstance == iMaterial) ++iEnd;
 
-        for (int i = 0; i < 3; ++i)
-        {
-            if (GeomToCompilerVertMesh[Face.m_iVertex[i]] == -1)
-            {
-                GeomToCompilerVertMesh[Face.m_iVertex[i]] = int(SubMesh.m_Vertex.size());
-                auto& CompilerVert = SubMesh.m_Vertex.emplace_back();
-                auto& RawVert = m_RawGeom.m_Vertex[Face.m_iVertex[i]];
+                    // Make sure that faces are sorted by materials
+                    assert(std::ranges::none_of(Mesh.m_SubMesh, [&](const sub_mesh& S) { return S.m_iMaterial == static_cast<std::uint32_t>(iMaterial); }));
 
-                CompilerVert.m_Binormal = RawVert.m_BTN[0].m_Binormal;
-                CompilerVert.m_Tangent = RawVert.m_BTN[0].m_Tangent;
-                CompilerVert.m_Normal = RawVert.m_BTN[0].m_Normal;
-                CompilerVert.m_Color = RawVert.m_Color[0];               // This could be n in the future...
-                CompilerVert.m_Position = RawVert.m_Position;
+                    auto& SubMesh = Mesh.m_SubMesh.emplace_back();
+                    SubMesh.m_iMaterial = iMaterial;
+                    SubMesh.m_Indices.reserve((iEnd - iBegin) * 3);
 
-                if (RawVert.m_nTangents) SubMesh.m_bHasBTN = true;
-                if (RawVert.m_nNormals) SubMesh.m_bHasNormal = true;
-                if (RawVert.m_nColors) SubMesh.m_bHasColor = true;
+                    // Reset only what the previous submesh used
+                    for (auto v : TouchedVerts) GeomToCompilerVert[v - MinVert] = -1;
+                    TouchedVerts.clear();
 
-                if (SubMesh.m_Indices.size() && SubMesh.m_nUVs != 0 && RawVert.m_nUVs < SubMesh.m_nUVs)
-                {
-                    static bool bDontShowAgain = true;
-                    if (bDontShowAgain)
+                    for (std::size_t f = iBegin; f < iEnd; ++f)
                     {
-                        bDontShowAgain = false;
-                        printf("WARNING: Found a vertex with an inconsistent set of uvs (Expecting %d, found %d) MeshName: %s \n"
-                            , SubMesh.m_nUVs
-                            , RawVert.m_nUVs
-                            , Mesh.m_Name.data()
-                        );
+                        for (int i = 0; i < 3; ++i)
+                        {
+                            const auto  iRaw  = static_cast<std::uint32_t>(Facets[f].m_iVertex[i]);
+                            auto&       Remap = GeomToCompilerVert[iRaw - MinVert];
+
+                            if (Remap == -1)
+                            {
+                                Remap = int(SubMesh.m_Vertex.size());
+                                TouchedVerts.push_back(iRaw);
+
+                                auto&       Streams = SubMesh.m_Vertex;
+                                auto&       RawVert = m_RawGeom.m_Vertex[iRaw];
+                                const auto  iVert   = Streams.size();
+
+                                Streams.m_Position.push_back(RawVert.m_Position);
+
+                                if (RawVert.m_nNormals)
+                                {
+                                    SubMesh.m_bHasNormal = true;
+                                    Streams.m_Normal.resize(iVert, xmath::fvec3::fromZero());
+                                    Streams.m_Normal.push_back(RawVert.m_BTN[0].m_Normal);
+                                }
+
+                                if (RawVert.m_nTangents)
+                                {
+                                    const auto& BTN = RawVert.m_BTN[0];
+                                    SubMesh.m_bHasBTN = true;
+                                    Streams.m_Tangent.resize(iVert, xmath::fvec3::fromZero());
+                                    Streams.m_Tangent.push_back(BTN.m_Tangent);
+                                    Streams.m_BinormalSign.resize(iVert, 1);
+                                    Streams.m_BinormalSign.push_back(xmath::fvec3::Dot(xmath::fvec3::Cross(BTN.m_Normal, BTN.m_Tangent), BTN.m_Binormal) >= 0.0f ? 1 : -1);
+                                }
+
+                                if (RawVert.m_nColors)
+                                {
+                                    SubMesh.m_bHasColor = true;
+                                    Streams.m_Color.resize(iVert);
+                                    Streams.m_Color.push_back(RawVert.m_Color[0]);      // This could be n in the future...
+                                }
+
+                                if (SubMesh.m_Indices.size() && SubMesh.m_nUVs != 0 && RawVert.m_nUVs < SubMesh.m_nUVs)
+                                {
+                                    if (not bDontShowAgain.exchange(true))
+                                    {
+                                        printf("WARNING: Found a vertex with an inconsistent set of uvs (Expecting %d, found %d) MeshName: %s \n"
+                                            , SubMesh.m_nUVs
+                                            , RawVert.m_nUVs
+                                            , Mesh.m_Name.data()
+                                        );
+                                    }
+                                }
+                                else
+                                {
+                                    SubMesh.m_nUVs = RawVert.m_nUVs;
+
+                                    for (int j = 0; j < RawVert.m_nUVs; ++j)
+                                    {
+                                        Streams.m_UVs[j].resize(iVert, xmath::fvec2(0.0f, 0.0f));
+                                        Streams.m_UVs[j].push_back(RawVert.m_UV[j]);
+                                    }
+                                }
+                            }
+
+                            assert(Remap >= 0);
+                            assert(Remap < m_RawGeom.m_Vertex.size());
+                            SubMesh.m_Indices.push_back(Remap);
+                        }
                     }
+
+                    SubMesh.m_Vertex.Finish();
+                    iBegin = iEnd;
                 }
-                else
-                {
-                    SubMesh.m_nUVs = RawVert.m_nUVs;
+            });
 
-                    for (int j = 0; j < RawVert.m_nUVs; ++j)
-                        CompilerVert.m_UVs[j] = RawVert.m_UV[j];
+            std::size_t nVerts = 0, nBytes = 0;
+            for (const auto& M : m_CompilerMesh)
+                for (const auto& S : M.m_SubMesh)
+                {
+                    nVerts += S.m_Vertex.size();
+                    nBytes += S.m_Vertex.getMemorySize();
                 }
-            }
+            LogMessage(xresource_pipeline::msg_type::INFO, std::format("Compiler vertices: {} ({} bytes)", nVerts, nBytes));
+        }
+
+        //--------------------------------------------------------------------------------------
+        // ConvertToCompilerMesh only shares vertices that had the same xraw3d index, different
+        // raw vertices that ended up with the same streams (split by bones/weights we drop,
+        // duplicated by the importer, ...) are collapsed here so the simplifier and the
+        // clusters see the real topology. The quantized duplicates are welded per cluster.
+
+        static std::size_t WeldSubMesh(sub_mesh& SubMesh) noexcept
+        {
+            auto&       V       = SubMesh.m_Vertex;
+            const auto  nVerts  = V.size();
+            if (nVerts == 0) return 0;
+
+            std::vector<meshopt_Stream> Streams;
+            Streams.push_back({ V.m_Position.data(), sizeof(float) * 3, vertex_streams::position_stride_v });
+            for (auto& UV : V.m_UVs) if (not UV.empty()) Streams.push_back({ UV.data(), sizeof(xmath::fvec2), sizeof(xmath::fvec2) });
+            if (not V.m_Color.empty())        Streams.push_back({ V.m_Color.data(),        sizeof(xcolori),      sizeof(xcolori)      });
+            if (not V.m_Normal.empty())       Streams.push_back({ V.m_Normal.data(),       sizeof(float) * 3,    sizeof(xmath::fvec3) });
+            if (not V.m_Tangent.empty())      Streams.push_back({ V.m_Tangent.data(),      sizeof(float) * 3,    sizeof(xmath::fvec3) });
+            if (not V.m_BinormalSign.empty()) Streams.push_back({ V.m_BinormalSign.data(), sizeof(std::int8_t),  sizeof(std::int8_t)  });
+
+            std::vector<unsigned int> Remap(nVerts);
+            const auto nUnique = meshopt_generateVertexRemapMulti(Remap.data(), SubMesh.m_Indices.data(), SubMesh.m_Indices.size(), nVerts, Streams.data(), Streams.size());
+            if (nUnique == nVerts) return 0;
+
+            meshopt_remapIndexBuffer(SubMesh.m_Indices.data(), SubMesh.m_Indices.data(), SubMesh.m_Indices.size(), Remap.data());
+
+            auto Compact = [&]<typename T>(std::vector<T>& Stream)
+            {
+                if (Stream.empty()) return;
+                std::vector<T> New(nUnique);
+                meshopt_remapVertexBuffer(New.data(), Stream.data(), nVerts, sizeof(T), Remap.data());
+                Stream = std::move(New);
+            };
+
+            Compact(V.m_Position);
+            for (auto& UV : V.m_UVs) Compact(UV);
+            Compact(V.m_Color);
+            Compact(V.m_Normal);
+            Compact(V.m_Tangent);
+            Compact(V.m_BinormalSign);
 
-            assert(GeomToCompilerVertMesh[Face.m_iVertex[i]] >= 0);
-            assert(GeomToCompilerVertMesh[Face.m_iVertex[i]] < m_RawGeom.m_Vertex.size());
-            SubMesh.m_Indices.push_back(GeomToCompilerVertMesh[Face.m_iVertex[i]]);
+            return nVerts - nUnique;
         }
-    }
-}
 
+        //--------------------------------------------------------------------------------------
+
+        void WeldCompilerMesh(void)
+        {
+            std::vector<sub_mesh*> SubMeshes;
+            for (auto& M : m_CompilerMesh)
+                for (auto& S : M.m_SubMesh)
+                    SubMeshes.push_back(&S);
+
+            std::vector<std::size_t> nWelded(SubMeshes.size());
+            ParallelFor(SubMeshes.size(), [&](std::size_t i)
+            {
+                nWelded[i] = WeldSubMesh(*SubMeshes[i]);
+            });
+
+            std::size_t Total = 0;
+            for (auto n : nWelded) Total += n;
+            LogMessage(xresource_pipeline::msg_type::INFO, std::format("Vertex welding: {} identical vertices removed", Total));
+        }
 
         //--------------------------------------------------------------------------------------
+        // Each submesh LOD chain is an independent job. The simplifier reads the position
+        // stream directly, the results only depend on the submesh itself so they are the
+        // same regardless of the job order.
 
         void GenenateLODs()
         {
+            struct lod_job
+            {
+                sub_mesh*                               m_pSubMesh;
+                const std::vector<xgeom_static::lod>*   m_pLODs;
+            };
+
+            std::vector<lod_job> Jobs;
             for (auto& M : m_CompilerMesh)
             {
                 auto it = m_NameToDetail.find(M.m_Name);
@@ -305,45 +795,35 @@ void ConvertToCompilerMesh(void)
                     continue;
 
                 for (auto& S : M.m_SubMesh)
-                {
-                    std::size_t IndexCount = S.m_Indices.size();
-
-                    for (size_t i = 0; i < details->m_LODs.size(); ++i)
-                    {
-                        const std::size_t target_index_count = std::size_t(IndexCount * details->m_LODs[i].m_LODReduction + 0.005f) / 3 * 3;
-                        const float target_error = 1e-2f;
-                        const auto& Source = (S.m_LODs.size()) ? S.m_LODs.back().m_Indices : S.m_Indices;
-
-                        if (Source.size() < target_index_count)
-                            break;
+                    Jobs.push_back({ &S, &details->m_LODs });
+            }
 
-                        auto& NewLod = S.m_LODs.emplace_back();
+            ParallelFor(Jobs.size(), [&](std::size_t iJob)
+            {
+                auto&       S           = *Jobs[iJob].m_pSubMesh;
+                const auto& LODs        = *Jobs[iJob].m_pLODs;
+                std::size_t IndexCount  = S.m_Indices.size();
 
-                        NewLod.m_Indices.resize(Source.size());
-                        std::size_t new_size = meshopt_simplify(NewLod.m_Indices.data(), Source.data(), Source.size(), &S.m_Vertex[0].m_Position[0], S.m_Vertex.size(), sizeof(vertex), target_index_count, target_error);
-                        NewLod.m_Indices.resize(new_size);
+                if (S.m_Vertex.empty()) return;
 
-                        IndexCount = new_size;
-                    }
-                }
-            }
-        }
+                for (size_t i = 0; i < LODs.size(); ++i)
+                {
+                    const std::size_t target_index_count = std::size_t(IndexCount * LODs[i].m_LODReduction + 0.005f) / 3 * 3;
+                    const float target_error = 1e-2f;
+                    const auto& Source = (S.m_LODs.size()) ? S.m_LODs.back().m_Indices : S.m_Indices;
 
-        //--------------------------------------------------------------------------------------
+                    if (Source.size() < target_index_count)
+                        break;
 
-        static xmath::fvec2 oct_wrap(xmath::fvec2 v) noexcept
-        {
-            return (xmath::fvec2(1.0f) - xmath::fvec2(v.m_Y, v.m_X).Abs()) * (v.Step({ 0 }) * 2.0f - 1.0f);
-        }
+                    auto& NewLod = S.m_LODs.emplace_back();
 
-        //--------------------------------------------------------------------------------------
+                    NewLod.m_Indices.resize(Source.size());
+                    std::size_t new_size = meshopt_simplify(NewLod.m_Indices.data(), Source.data(), Source.size(), S.m_Vertex.getPositions(), S.m_Vertex.size(), vertex_streams::position_stride_v, target_index_count, target_error);
+                    NewLod.m_Indices.resize(new_size);
 
-        static xmath::fvec2 oct_encode(xmath::fvec3 n) noexcept
-        {
-            n /= (xmath::Abs(n.m_X) + xmath::Abs(n.m_Y) + xmath::Abs(n.m_Z));
-            xmath::fvec2 p = xmath::fvec2(n.m_X, n.m_Y);
-            if (n.m_Z < 0.0f) p = oct_wrap(p);
-            return p;
+                    IndexCount = new_size;
+                }
+            });
         }
 
         //--------------------------------------------------------------------------------------
@@ -380,12 +860,6 @@ void ConvertToCompilerMesh(void)
         };
 
         //--------------------------------------------------------------------------------------
-        // Cluster for recursive splitting (triangle ids)
-
-        struct TriCluster
-        {
-            std::vector<uint32_t> tri_ids;
-        };
 
         static xmath::fvec3 oct_decode(xmath::fvec2 e)
         {
@@ -402,142 +876,615 @@ void ConvertToCompilerMesh(void)
         }
 
         //--------------------------------------------------------------------------------------
+        // SIMD reductions over contiguous float arrays (SSE, AVX when the compiler allows it)
 
-        static void RecurseClusterSplit
-        ( const std::vector<vertex>&        InputVerts
-        , const std::vector<uint32_t>&      InputIndices
-        , const TriCluster&                 c
-        , uint32_t                          MaxVerts
-        , const float                       MaxExtent
-        , const std::vector<float>&         BinormalSigns
-        , std::vector<geom::cluster>&       OutputClusters
-        , std::vector<geom::vertex>&        AllStaticVerts
-        , std::vector<geom::vertex_extras>& AllExtrasVerts
-        , std::vector<geom::cluster_data>&  AllClusterData
-        , std::vector<uint32_t>&            AllIndices
-        )
+        static float ReduceMin(const float* pData, std::size_t Count) noexcept
         {
-            if (c.tri_ids.empty()) return;
-            BBox3 bb_pos;
-            BBox2 bb_uv;
+            float       Result  = std::numeric_limits<float>::max();
+            std::size_t i       = 0;
+        #if XGEOM_STATIC_COMPILER_SSE
+            #if defined(__AVX__)
+            if (Count >= 8)
+            {
+                __m256 Acc = _mm256_set1_ps(Result);
+                for (; i + 8 <= Count; i += 8) Acc = _mm256_min_ps(Acc, _mm256_loadu_ps(pData + i));
+                const __m128 Lo = _mm_min_ps(_mm256_castps256_ps128(Acc), _mm256_extractf128_ps(Acc, 1));
+                alignas(16) float Lanes[4];
+                _mm_store_ps(Lanes, Lo);
+                Result = std::min({ Lanes[0], Lanes[1], Lanes[2], Lanes[3] });
+            }
+            #endif
+            if (i + 4 <= Count)
+            {
+                __m128 Acc = _mm_set1_ps(Result);
+                for (; i + 4 <= Count; i += 4) Acc = _mm_min_ps(Acc, _mm_loadu_ps(pData + i));
+                alignas(16) float Lanes[4];
+                _mm_store_ps(Lanes, Acc);
+                Result = std::min({ Lanes[0], Lanes[1], Lanes[2], Lanes[3] });
+            }
+        #endif
+            for (; i < Count; ++i) Result = std::min(Result, pData[i]);
+            return Result;
+        }
+
+        //--------------------------------------------------------------------------------------
 
-            for (uint32_t ti : c.tri_ids)
+        static float ReduceMax(const float* pData, std::size_t Count) noexcept
+        {
+            float       Result  = std::numeric_limits<float>::lowest();
+            std::size_t i       = 0;
+        #if XGEOM_STATIC_COMPILER_SSE
+            #if defined(__AVX__)
+            if (Count >= 8)
             {
-                for (int j = 0; j < 3; ++j)
-                {
-                    uint32_t vi = InputIndices[ti * 3 + j];
-                    bb_pos.Update(InputVerts[vi].m_Position);
-                    bb_uv.Update(InputVerts[vi].m_UVs[0]);
-                }
+                __m256 Acc = _mm256_set1_ps(Result);
+                for (; i + 8 <= Count; i += 8) Acc = _mm256_max_ps(Acc, _mm256_loadu_ps(pData + i));
+                const __m128 Hi = _mm_max_ps(_mm256_castps256_ps128(Acc), _mm256_extractf128_ps(Acc, 1));
+                alignas(16) float Lanes[4];
+                _mm_store_ps(Lanes, Hi);
+                Result = std::max({ Lanes[0], Lanes[1], Lanes[2], Lanes[3] });
             }
+            #endif
+            if (i + 4 <= Count)
+            {
+                __m128 Acc = _mm_set1_ps(Result);
+                for (; i + 4 <= Count; i += 4) Acc = _mm_max_ps(Acc, _mm_loadu_ps(pData + i));
+                alignas(16) float Lanes[4];
+                _mm_store_ps(Lanes, Acc);
+                Result = std::max({ Lanes[0], Lanes[1], Lanes[2], Lanes[3] });
+            }
+        #endif
+            for (; i < Count; ++i) Result = std::max(Result, pData[i]);
+            return Result;
+        }
 
-            xmath::fvec3    extent_pos      = bb_pos.m_MaxPos - bb_pos.m_MinPos;
-            xmath::fvec2    extent_uv       = bb_uv.m_MaxUV - bb_uv.m_MinUV;
-            float           max_e_pos       = std::max({ extent_pos.m_X, extent_pos.m_Y, extent_pos.m_Z });
-            float           max_e_uv        = std::max(extent_uv.m_X, extent_uv.m_Y);
-            bool            small_extent    = (max_e_pos <= MaxExtent && max_e_uv <= MaxExtent);
+        //--------------------------------------------------------------------------------------
+        // Writes 1 into pSide[i] when pData[i] >= Split (goes to the right side), 0 otherwise.
 
-            std::unordered_set<uint32_t> used_verts;
-            if (small_extent)
+        static void ClassifySide(const float* pData, std::size_t Count, float Split, std::uint8_t* pSide) noexcept
+        {
+            std::size_t i = 0;
+        #if XGEOM_STATIC_COMPILER_SSE
+            const __m128 S = _mm_set1_ps(Split);
+            for (; i + 4 <= Count; i += 4)
             {
-                for (uint32_t ti : c.tri_ids)
-                {
-                    for (int j = 0; j < 3; ++j)
-                    {
-                        used_verts.insert(InputIndices[ti * 3 + j]);
-                    }
-                }
+                const int Mask = _mm_movemask_ps(_mm_cmplt_ps(_mm_loadu_ps(pData + i), S));
+                pSide[i + 0] = static_cast<std::uint8_t>(((Mask >> 0) & 1) ^ 1);
+                pSide[i + 1] = static_cast<std::uint8_t>(((Mask >> 1) & 1) ^ 1);
+                pSide[i + 2] = static_cast<std::uint8_t>(((Mask >> 2) & 1) ^ 1);
+                pSide[i + 3] = static_cast<std::uint8_t>(((Mask >> 3) & 1) ^ 1);
             }
+        #endif
+            for (; i < Count; ++i) pSide[i] = (pData[i] < Split) ? 0 : 1;
+        }
+
+        //--------------------------------------------------------------------------------------
+        // Stable partition driven by a side table, the right side goes through pTemp.
+        // Returns the number of elements that ended up on the left side.
 
-            if (small_extent && used_verts.size() <= MaxVerts)
+        template< typename T >
+        static std::size_t StablePartition(T* pData, T* pTemp, const std::uint8_t* pSide, std::size_t Count) noexcept
+        {
+            std::size_t nLeft  = 0;
+            std::size_t nRight = 0;
+            for (std::size_t i = 0; i < Count; ++i)
             {
-                // Remap verts locally
-                std::vector<uint32_t> new_vert_ids(used_verts.begin(), used_verts.end());
-                std::sort(new_vert_ids.begin(), new_vert_ids.end());
-                std::unordered_map<uint32_t, uint32_t> old_to_new = {};
-                uint32_t new_id = 0;
-                for (uint32_t ov : new_vert_ids)
-                {
-                    old_to_new[ov] = new_id++;
-                }
+                if (pSide[i])   pTemp[nRight++] = pData[i];
+                else            pData[nLeft++]  = pData[i];
+            }
+            std::copy(pTemp, pTemp + nRight, pData + nLeft);
+            return nLeft;
+        }
 
-                // Use precomputed bboxes
-                xmath::fvec3 pos_min    = bb_pos.m_MinPos;
-                xmath::fvec3 pos_max    = bb_pos.m_MaxPos;
-                xmath::fvec3 pos_center = (pos_min + pos_max) * 0.5f;
-                xmath::fvec3 pos_scale  = xmath::fvec3::Max((pos_max - pos_min) * 0.5f, xmath::fvec3(1e-6f));
-                xmath::fvec2 uv_min     = bb_uv.m_MinUV;
-                xmath::fvec2 uv_max     = bb_uv.m_MaxUV;
-                xmath::fvec2 uv_scale   = xmath::fvec2::Max(uv_max - uv_min, xmath::fvec2(1e-6f));
+        //--------------------------------------------------------------------------------------
+        // Output of a single (mesh, lod, submesh) clustering job. All the offsets stored inside
+        // (cluster::m_iIndex, cluster::m_iVertex) are local to the job, they get rebased when
+        // the jobs are concatenated back in order.
 
-                // Build local indices
-                std::vector<unsigned int> local_indices;
-                local_indices.reserve(c.tri_ids.size() * 3);
-                for (uint32_t ti : c.tri_ids)
-                {
-                    for (int j = 0; j < 3; ++j)
-                    {
-                        uint32_t ov = InputIndices[ti * 3 + j];
-                        local_indices.push_back(old_to_new[ov]);
-                    }
-                }
+        struct cluster_output
+        {
+            std::vector<geom::cluster>          m_Clusters;
+            std::vector<geom::vertex>           m_StaticVerts;
+            std::vector<geom::vertex_extras>    m_ExtrasVerts;
+            std::vector<geom::cluster_data>     m_ClusterData;
+            std::vector<uint32_t>               m_Indices;
+            std::vector<uint32_t>               m_VertexInputIds;       // Input vertex of every output vertex
+            std::size_t                         m_nLeafClusters = 0;    // Leaves found by the splitter before any merging
+            std::size_t                         m_nSharedClusters = 0;  // Index-only clusters (first in m_Clusters) using the LOD0 vertices
+            std::size_t                         m_nSharedVertexBytes = 0;   // Vertex data the shared clusters did not have to duplicate
+            std::vector<geom::cluster_lod>      m_ClusterLOD;           // Only for the cluster DAG, one per cluster
+            std::size_t                         m_nDAGLevels = 0;
+            std::size_t                         m_nWeldedVertices = 0;  // Vertices collapsed because they quantized to the same values
+        };
 
-                // Optimize vertex cache
-                meshopt_optimizeVertexCache(local_indices.data(), local_indices.data(), local_indices.size(), static_cast<unsigned int>(new_vert_ids.size()));
+        //--------------------------------------------------------------------------------------
+        // Working memory for the cluster splitter. It is sized once per submesh so splitting
+        // and emitting clusters does not go back to the heap (vectors only get cleared).
 
-                // Prepare positions for overdraw optimization
-                std::vector<float> local_positions(new_vert_ids.size() * 3);
-                for (uint32_t i = 0; i < new_vert_ids.size(); ++i)
-                {
-                    const auto& pos = InputVerts[new_vert_ids[i]].m_Position;
-                    local_positions[i * 3 + 0] = pos.m_X;
-                    local_positions[i * 3 + 1] = pos.m_Y;
-                    local_positions[i * 3 + 2] = pos.m_Z;
-                }
+        struct cluster_scratch
+        {
+            struct range
+            {
+                uint32_t                        m_Begin;
+                uint32_t                        m_End;
+            };
 
-                // Optimize overdraw
-                meshopt_optimizeOverdraw(local_indices.data(), local_indices.data(), local_indices.size(), local_positions.data(), static_cast<unsigned int>(new_vert_ids.size()), sizeof(float) * 3, 1.05f);
+            // Structure of arrays with the per triangle data, every table is partitioned together
+            // with m_TriIds so a cluster is always a contiguous range of all of them.
+            // Channels: 0,1,2 = position xyz, 3,4 = uv0
+            static constexpr int                channels_v = 5;
 
-                // Generate fetch remap
-                std::vector<unsigned int> fetch_remap(new_vert_ids.size());
-                meshopt_optimizeVertexFetchRemap(fetch_remap.data(), local_indices.data(), local_indices.size(), static_cast<unsigned int>(new_vert_ids.size()));
+            std::vector<uint32_t>               m_TriIds;           // Triangle ids, partitioned in place
+            std::vector<uint32_t>               m_TriTemp;          // Right hand side of a stable partition
+            std::array<std::vector<float>, channels_v> m_Centroid;
+            std::array<std::vector<float>, channels_v> m_Min;
+            std::array<std::vector<float>, channels_v> m_Max;
+            std::vector<float>                  m_FloatTemp;        // Right hand side of a stable partition
+            std::vector<std::uint8_t>           m_Side;             // Partition side of each triangle in a range
 
-                // Pack original compressed vertices and extras
-                std::vector<geom::vertex>           original_static(new_vert_ids.size());
-                std::vector<geom::vertex_extras>    original_extras(new_vert_ids.size());
-                for (uint32_t i = 0; i < new_vert_ids.size(); ++i)
+            struct leaf
+            {
+                range                           m_Range;
+                float                           m_Min[channels_v];
+                float                           m_Max[channels_v];
+            };
+
+            std::vector<range>                  m_Stack;            // Ranges of m_TriIds waiting to be processed
+            std::vector<leaf>                   m_Leaves;           // Leaves waiting to be merged
+            std::vector<uint32_t>               m_VertStamp;        // Generation in which an input vertex was last seen
+            std::vector<uint32_t>               m_VertRemap;        // Input vertex -> cluster local vertex
+            std::vector<uint32_t>               m_UsedVerts;        // Cluster local vertex -> input vertex
+            std::vector<unsigned int>           m_LocalIndices;
+            std::vector<float>                  m_LocalPositions;
+            std::vector<unsigned int>           m_FetchRemap;
+            std::vector<geom::vertex>           m_OriginalStatic;
+            std::vector<geom::vertex_extras>    m_OriginalExtras;
+            std::vector<meshopt_Meshlet>        m_Meshlets;
+            std::vector<unsigned int>           m_MeshletVertices;
+            std::vector<unsigned char>          m_MeshletTriangles;
+            std::vector<uint32_t>               m_MeshletInputIds;
+            std::vector<unsigned int>           m_MeshletIndices;
+            std::vector<uint32_t>               m_WeldedIds;        // Cluster local vertex -> input vertex after welding
+            std::vector<unsigned int>           m_WeldRemap;
+            uint32_t                            m_Generation = 0;
+            bool                                m_bWeld      = false;
+            float                               m_MinPosScale = 1e-6f;  // Smallest half extent a cluster quantizes over
+
+            void Initialize(const vertex_streams& InputVerts, const std::vector<uint32_t>& InputIndices, uint32_t MaxVerts)
+            {
+                const std::size_t nVerts = InputVerts.size();
+                const std::size_t nTris  = InputIndices.size() / 3;
+
+                m_TriIds.resize(nTris);
+                for (uint32_t i = 0; i < nTris; ++i) m_TriIds[i] = i;
+
+                m_TriTemp.resize(nTris);
+                m_FloatTemp.resize(nTris);
+                m_Side.resize(nTris);
+
+                //
+                // The only pass that touches the fat vertices until a cluster gets emitted
+                //
+                for (int c = 0; c < channels_v; ++c)
+                {
+                    m_Centroid[c].resize(nTris);
+                    m_Min[c].resize(nTris);
+                    m_Max[c].resize(nTris);
+                }
+
+                for (std::size_t t = 0; t < nTris; ++t)
+                {
+                    const auto  i0  = InputIndices[t * 3 + 0];
+                    const auto  i1  = InputIndices[t * 3 + 1];
+                    const auto  i2  = InputIndices[t * 3 + 2];
+                    const auto& P0  = InputVerts.m_Position[i0];
+                    const auto& P1  = InputVerts.m_Position[i1];
+                    const auto& P2  = InputVerts.m_Position[i2];
+                    const auto  UV0 = InputVerts.getUV(i0);
+                    const auto  UV1 = InputVerts.getUV(i1);
+                    const auto  UV2 = InputVerts.getUV(i2);
+
+                    const float Values[channels_v][3] =
+                    { { P0.m_X,  P1.m_X,  P2.m_X  }
+                    , { P0.m_Y,  P1.m_Y,  P2.m_Y  }
+                    , { P0.m_Z,  P1.m_Z,  P2.m_Z  }
+                    , { UV0.m_X, UV1.m_X, UV2.m_X }
+                    , { UV0.m_Y, UV1.m_Y, UV2.m_Y }
+                    };
+
+                    for (int c = 0; c < channels_v; ++c)
+                    {
+                        m_Centroid[c][t] = (Values[c][0] + Values[c][1] + Values[c][2]) / 3.0f;
+                        m_Min[c][t]      = std::min({ Values[c][0], Values[c][1], Values[c][2] });
+                        m_Max[c][t]      = std::max({ Values[c][0], Values[c][1], Values[c][2] });
+                    }
+                }
+
+                m_Stack.clear();
+                m_Stack.reserve(64);
+                m_Leaves.clear();
+
+                m_VertStamp.assign(nVerts, 0);
+                m_VertRemap.resize(nVerts);
+                m_Generation = 0;
+
+                const std::size_t MaxLocalVerts = std::min<std::size_t>(nVerts, MaxVerts);
+                m_UsedVerts.reserve(MaxLocalVerts + 1);
+                m_LocalIndices.reserve(nTris * 3);
+                m_LocalPositions.reserve(MaxLocalVerts * 3);
+                m_FetchRemap.reserve(MaxLocalVerts);
+                m_OriginalStatic.reserve(MaxLocalVerts);
+                m_OriginalExtras.reserve(MaxLocalVerts);
+            }
+
+            // Starts a new vertex set, old stamps become stale without having to clear them
+            void NextGeneration()
+            {
+                if (++m_Generation == 0)
+                {
+                    std::fill(m_VertStamp.begin(), m_VertStamp.end(), 0u);
+                    m_Generation = 1;
+                }
+            }
+        };
+
+        //--------------------------------------------------------------------------------------
+        // Adds the unique vertices used by a range of triangles to the current vertex set
+        // (S.m_UsedVerts in first touch order, S.m_VertRemap for the lookups). Returns false
+        // as soon as the set would grow beyond MaxVerts, what was added so far stays.
+
+        static bool AppendClusterVerts
+        ( const std::vector<uint32_t>&      InputIndices
+        , cluster_scratch&                  S
+        , const cluster_scratch::range      R
+        , uint32_t                          MaxVerts
+        ) noexcept
+        {
+            for (uint32_t i = R.m_Begin; i < R.m_End; ++i)
+            {
+                const uint32_t ti = S.m_TriIds[i];
+                for (int j = 0; j < 3; ++j)
+                {
+                    const uint32_t vi = InputIndices[ti * 3 + j];
+                    if (S.m_VertStamp[vi] == S.m_Generation) continue;
+
+                    if (S.m_UsedVerts.size() == MaxVerts) return false;
+
+                    S.m_VertStamp[vi] = S.m_Generation;
+                    S.m_VertRemap[vi] = static_cast<uint32_t>(S.m_UsedVerts.size());
+                    S.m_UsedVerts.push_back(vi);
+                }
+            }
+
+            return true;
+        }
+
+        //--------------------------------------------------------------------------------------
+        // Starts a new vertex set with the vertices of a range of triangles
+
+        static bool CollectClusterVerts
+        ( const std::vector<uint32_t>&      InputIndices
+        , cluster_scratch&                  S
+        , const cluster_scratch::range      R
+        , uint32_t                          MaxVerts
+        ) noexcept
+        {
+            S.NextGeneration();
+            S.m_UsedVerts.clear();
+            return AppendClusterVerts(InputIndices, S, R, MaxVerts);
+        }
+
+        //--------------------------------------------------------------------------------------
+        // Quantization frame of a cluster, positions are mapped into the int16 range and the
+        // UVs into the uint16 range of the cluster bounds.
+
+        struct cluster_quantization
+        {
+            xmath::fvec3    m_PosCenter;
+            xmath::fvec3    m_PosScale;
+            xmath::fvec2    m_UVMin;
+            xmath::fvec2    m_UVScale;
+
+            // MinPosScale keeps the position step of small clusters at the mesh precision instead
+            // of stretching them over the full 16 bits (see cluster_scratch::m_MinPosScale)
+            cluster_quantization(const BBox3& bb_pos, const BBox2& bb_uv, float MinPosScale = 1e-6f) noexcept
+                : m_PosCenter   { (bb_pos.m_MinPos + bb_pos.m_MaxPos) * 0.5f }
+                , m_PosScale    { xmath::fvec3::Max((bb_pos.m_MaxPos - bb_pos.m_MinPos) * 0.5f, xmath::fvec3(MinPosScale)) }
+                , m_UVMin       { bb_uv.m_MinUV }
+                , m_UVScale     { xmath::fvec2::Max(bb_uv.m_MaxUV - bb_uv.m_MinUV, xmath::fvec2(1e-6f)) }
+            {}
+
+            geom::cluster_data getClusterData(void) const noexcept
+            {
+                geom::cluster_data  cd;
+                cd.m_PosScaleAndWPADDING.m_X        = m_PosScale.m_X;
+                cd.m_PosScaleAndWPADDING.m_Y        = m_PosScale.m_Y;
+                cd.m_PosScaleAndWPADDING.m_Z        = m_PosScale.m_Z;
+                cd.m_PosScaleAndWPADDING.m_W        = 0;
+                cd.m_PosTrasnlationAndWPADDING.m_X  = m_PosCenter.m_X;
+                cd.m_PosTrasnlationAndWPADDING.m_Y  = m_PosCenter.m_Y;
+                cd.m_PosTrasnlationAndWPADDING.m_Z  = m_PosCenter.m_Z;
+                cd.m_PosTrasnlationAndWPADDING.m_W  = 0;
+                cd.m_UVScaleTranslation.m_X         = m_UVScale.m_X;
+                cd.m_UVScaleTranslation.m_Y         = m_UVScale.m_Y;
+                cd.m_UVScaleTranslation.m_Z         = m_UVMin.m_X;
+                cd.m_UVScaleTranslation.m_W         = m_UVMin.m_Y;
+                return cd;
+            }
+        };
+
+        //--------------------------------------------------------------------------------------
+        // Batch vertex quantization. The vertices of a cluster are gathered in blocks of SoA
+        // lanes and quantized a register at a time (AVX 8, SSE 4, scalar 1). The three paths
+        // run the same kernel with the same float operations in the same order and round with
+        // trunc + a half away from zero fixup (what std::round does) so they are bit identical.
+
+        struct simd_scalar
+        {
+            using f = float;
+            using i = std::int32_t;
+            using m = bool;
+            inline static constexpr std::size_t width_v = 1;
+
+            static f    Load    (const float* p)        noexcept { return *p; }
+            static f    Set     (float v)               noexcept { return v; }
+            static f    Add     (f a, f b)              noexcept { return a + b; }
+            static f    Sub     (f a, f b)              noexcept { return a - b; }
+            static f    Mul     (f a, f b)              noexcept { return a * b; }
+            static f    Div     (f a, f b)              noexcept { return a / b; }
+            static f    Sqrt    (f a)                   noexcept { return std::sqrt(a); }
+            static f    Abs     (f a)                   noexcept { return std::abs(a); }
+            static m    CmpGE   (f a, f b)              noexcept { return a >= b; }
+            static m    CmpGT   (f a, f b)              noexcept { return a >  b; }
+            static m    CmpLE   (f a, f b)              noexcept { return a <= b; }
+            static m    CmpLT   (f a, f b)              noexcept { return a <  b; }
+            static f    Select  (m M, f a, f b)         noexcept { return M ? a : b; }
+            static i    Trunc   (f a)                   noexcept { return static_cast<i>(a); }
+            static f    ToFloat (i a)                   noexcept { return static_cast<f>(a); }
+            static void Store   (std::int32_t* p, i a)  noexcept { *p = a; }
+        };
+
+    #if XGEOM_STATIC_COMPILER_SSE
+        struct simd_sse
+        {
+            using f = __m128;
+            using i = __m128i;
+            using m = __m128;
+            inline static constexpr std::size_t width_v = 4;
+
+            static f    Load    (const float* p)        noexcept { return _mm_load_ps(p); }
+            static f    Set     (float v)               noexcept { return _mm_set1_ps(v); }
+            static f    Add     (f a, f b)              noexcept { return _mm_add_ps(a, b); }
+            static f    Sub     (f a, f b)              noexcept { return _mm_sub_ps(a, b); }
+            static f    Mul     (f a, f b)              noexcept { return _mm_mul_ps(a, b); }
+            static f    Div     (f a, f b)              noexcept { return _mm_div_ps(a, b); }
+            static f    Sqrt    (f a)                   noexcept { return _mm_sqrt_ps(a); }
+            static f    Abs     (f a)                   noexcept { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+            static m    CmpGE   (f a, f b)              noexcept { return _mm_cmpge_ps(a, b); }
+            static m    CmpGT   (f a, f b)              noexcept { return _mm_cmpgt_ps(a, b); }
+            static m    CmpLE   (f a, f b)              noexcept { return _mm_cmple_ps(a, b); }
+            static m    CmpLT   (f a, f b)              noexcept { return _mm_cmplt_ps(a, b); }
+            static f    Select  (m M, f a, f b)         noexcept { return _mm_or_ps(_mm_and_ps(M, a), _mm_andnot_ps(M, b)); }
+            static i    Trunc   (f a)                   noexcept { return _mm_cvttps_epi32(a); }
+            static f    ToFloat (i a)                   noexcept { return _mm_cvtepi32_ps(a); }
+            static void Store   (std::int32_t* p, i a)  noexcept { _mm_store_si128(reinterpret_cast<__m128i*>(p), a); }
+        };
+
+        #if defined(__AVX__)
+        struct simd_avx
+        {
+            using f = __m256;
+            using i = __m256i;
+            using m = __m256;
+            inline static constexpr std::size_t width_v = 8;
+
+            static f    Load    (const float* p)        noexcept { return _mm256_load_ps(p); }
+            static f    Set     (float v)               noexcept { return _mm256_set1_ps(v); }
+            static f    Add     (f a, f b)              noexcept { return _mm256_add_ps(a, b); }
+            static f    Sub     (f a, f b)              noexcept { return _mm256_sub_ps(a, b); }
+            static f    Mul     (f a, f b)              noexcept { return _mm256_mul_ps(a, b); }
+            static f    Div     (f a, f b)              noexcept { return _mm256_div_ps(a, b); }
+            static f    Sqrt    (f a)                   noexcept { return _mm256_sqrt_ps(a); }
+            static f    Abs     (f a)                   noexcept { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+            static m    CmpGE   (f a, f b)              noexcept { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+            static m    CmpGT   (f a, f b)              noexcept { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+            static m    CmpLE   (f a, f b)              noexcept { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+            static m    CmpLT   (f a, f b)              noexcept { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+            static f    Select  (m M, f a, f b)         noexcept { return _mm256_blendv_ps(b, a, M); }
+            static i    Trunc   (f a)                   noexcept { return _mm256_cvttps_epi32(a); }
+            static f    ToFloat (i a)                   noexcept { return _mm256_cvtepi32_ps(a); }
+            static void Store   (std::int32_t* p, i a)  noexcept { _mm256_store_si256(reinterpret_cast<__m256i*>(p), a); }
+        };
+        #endif
+    #endif
+
+    #if XGEOM_STATIC_COMPILER_SSE && defined(__AVX__)
+        using simd_encoder = simd_avx;
+    #elif XGEOM_STATIC_COMPILER_SSE
+        using simd_encoder = simd_sse;
+    #else
+        using simd_encoder = simd_scalar;
+    #endif
+
+        //--------------------------------------------------------------------------------------
+
+        struct encode_lanes
+        {
+            enum in_channel : std::uint8_t
+            { IN_PX, IN_PY, IN_PZ, IN_U, IN_V, IN_NX, IN_NY, IN_NZ, IN_TX, IN_TY, IN_TZ, IN_COUNT };
+
+            enum out_channel : std::uint8_t
+            { OUT_PX, OUT_PY, OUT_PZ, OUT_U, OUT_V, OUT_NX, OUT_NY, OUT_TX, OUT_TY, OUT_COUNT };
+
+            inline static constexpr std::size_t block_v = 64;      // Multiple of every register width
+
+            alignas(32) float           m_In [IN_COUNT] [block_v];
+            alignas(32) std::int32_t    m_Out[OUT_COUNT][block_v];
+        };
+
+        //--------------------------------------------------------------------------------------
+
+        template< typename T >
+        static typename T::i RoundLanes(typename T::f x) noexcept
+        {
+            const auto ti  = T::Trunc(x);
+            const auto t   = T::ToFloat(ti);
+            const auto d   = T::Sub(x, t);
+            const auto adj = T::Select(T::CmpGE(d, T::Set(0.5f)), T::Set(1.0f), T::Select(T::CmpLE(d, T::Set(-0.5f)), T::Set(-1.0f), T::Set(0.0f)));
+            return T::Trunc(T::Add(t, adj));
+        }
+
+        //--------------------------------------------------------------------------------------
+        // Normalizes (a zero vector becomes +Z), octahedral encodes and quantizes to Scale
+
+        template< typename T >
+        static void OctLanes(const float* pX, const float* pY, const float* pZ, float ScaleX, float ScaleY, std::int32_t* pOutX, std::int32_t* pOutY) noexcept
+        {
+            const auto Zero = T::Set(0.0f), One = T::Set(1.0f), NegOne = T::Set(-1.0f), Half = T::Set(0.5f);
+
+            auto       x     = T::Load(pX);
+            auto       y     = T::Load(pY);
+            auto       z     = T::Load(pZ);
+            const auto Len2  = T::Add(T::Add(T::Mul(x, x), T::Mul(y, y)), T::Mul(z, z));
+            const auto Valid = T::CmpGT(Len2, Zero);
+            const auto Len   = T::Sqrt(T::Select(Valid, Len2, One));
+            x = T::Select(Valid, T::Div(x, Len), Zero);
+            y = T::Select(Valid, T::Div(y, Len), Zero);
+            z = T::Select(Valid, T::Div(z, Len), One);
+
+            const auto Sum = T::Add(T::Add(T::Abs(x), T::Abs(y)), T::Abs(z));
+            auto       ox  = T::Div(x, Sum);
+            auto       oy  = T::Div(y, Sum);
+            const auto oz  = T::Div(z, Sum);
+
+            const auto wx  = T::Mul(T::Sub(One, T::Abs(oy)), T::Select(T::CmpGE(ox, Zero), One, NegOne));
+            const auto wy  = T::Mul(T::Sub(One, T::Abs(ox)), T::Select(T::CmpGE(oy, Zero), One, NegOne));
+            const auto Neg = T::CmpLT(oz, Zero);
+            ox = T::Select(Neg, wx, ox);
+            oy = T::Select(Neg, wy, oy);
+
+            T::Store(pOutX, RoundLanes<T>(T::Mul(T::Add(T::Mul(ox, Half), Half), T::Set(ScaleX))));
+            T::Store(pOutY, RoundLanes<T>(T::Mul(T::Add(T::Mul(oy, Half), Half), T::Set(ScaleY))));
+        }
+
+        //--------------------------------------------------------------------------------------
+
+        template< typename T >
+        static void QuantizeLanes(encode_lanes& L, std::size_t Count, const cluster_quantization& Q) noexcept
+        {
+            using E = encode_lanes;
+
+            const float PosCenter[] = { Q.m_PosCenter.m_X, Q.m_PosCenter.m_Y, Q.m_PosCenter.m_Z };
+            const float PosScale[]  = { Q.m_PosScale.m_X,  Q.m_PosScale.m_Y,  Q.m_PosScale.m_Z  };
+            const float UVMin[]     = { Q.m_UVMin.m_X,     Q.m_UVMin.m_Y   };
+            const float UVScale[]   = { Q.m_UVScale.m_X,   Q.m_UVScale.m_Y };
+
+            for (std::size_t i = 0; i < Count; i += T::width_v)
+            {
+                for (int c = 0; c < 3; ++c)
+                {
+                    auto p = T::Div(T::Sub(T::Load(&L.m_In[E::IN_PX + c][i]), T::Set(PosCenter[c])), T::Set(PosScale[c]));
+                    p = T::Sub(T::Mul(T::Add(p, T::Set(1.0f)), T::Set(32767.5f)), T::Set(32768.0f));
+                    T::Store(&L.m_Out[E::OUT_PX + c][i], RoundLanes<T>(p));
+                }
+
+                for (int c = 0; c < 2; ++c)
+                {
+                    const auto uv = T::Div(T::Sub(T::Load(&L.m_In[E::IN_U + c][i]), T::Set(UVMin[c])), T::Set(UVScale[c]));
+                    T::Store(&L.m_Out[E::OUT_U + c][i], RoundLanes<T>(T::Mul(uv, T::Set(65535.0f))));
+                }
+
+                // Oct normal 12/12 bits, oct tangent 12/11 bits
+                OctLanes<T>(&L.m_In[E::IN_NX][i], &L.m_In[E::IN_NY][i], &L.m_In[E::IN_NZ][i], 4095.0f, 4095.0f, &L.m_Out[E::OUT_NX][i], &L.m_Out[E::OUT_NY][i]);
+                OctLanes<T>(&L.m_In[E::IN_TX][i], &L.m_In[E::IN_TY][i], &L.m_In[E::IN_TZ][i], 4095.0f, 2047.0f, &L.m_Out[E::OUT_TX][i], &L.m_Out[E::OUT_TY][i]);
+            }
+        }
+
+        //--------------------------------------------------------------------------------------
+        // Compresses a list of input vertices into the final vertex + extras format
+
+        static void EncodeVertices
+        ( const vertex_streams&             InputVerts
+        , const std::vector<float>&         BinormalSigns
+        , const uint32_t*                   pInputIds
+        , const std::size_t                 Count
+        , const cluster_quantization&       Q
+        , geom::vertex*                     pStatic
+        , geom::vertex_extras*              pExtras
+        ) noexcept
+        {
+            using E = encode_lanes;
+            E L;
+
+            for (std::size_t Base = 0; Base < Count; Base += E::block_v)
+            {
+                const std::size_t n       = std::min(E::block_v, Count - Base);
+                const std::size_t nPadded = (n + simd_encoder::width_v - 1) / simd_encoder::width_v * simd_encoder::width_v;
+
+                //
+                // Gather the cluster vertices into lanes, the padding lanes are zero
+                //
+                for (std::size_t i = 0; i < nPadded; ++i)
+                {
+                    if (i >= n)
+                    {
+                        for (auto& C : L.m_In) C[i] = 0;
+                        continue;
+                    }
+
+                    const uint32_t ov = pInputIds[Base + i];
+                    const auto&    P  = InputVerts.m_Position[ov];
+                    const auto     UV = InputVerts.getUV(ov);
+                    const auto     N  = InputVerts.getNormal(ov);
+                    const auto     T  = InputVerts.getTangent(ov);
+
+                    L.m_In[E::IN_PX][i] = P.m_X;  L.m_In[E::IN_PY][i] = P.m_Y;  L.m_In[E::IN_PZ][i] = P.m_Z;
+                    L.m_In[E::IN_U ][i] = UV.m_X; L.m_In[E::IN_V ][i] = UV.m_Y;
+                    L.m_In[E::IN_NX][i] = N.m_X;  L.m_In[E::IN_NY][i] = N.m_Y;  L.m_In[E::IN_NZ][i] = N.m_Z;
+                    L.m_In[E::IN_TX][i] = T.m_X;  L.m_In[E::IN_TY][i] = T.m_Y;  L.m_In[E::IN_TZ][i] = T.m_Z;
+                }
+
+                QuantizeLanes<simd_encoder>(L, nPadded, Q);
+
+            #if !defined(NDEBUG)
+                // The scalar kernel is the reference, the SIMD one must match it bit for bit
+                if constexpr (simd_encoder::width_v > 1)
+                {
+                    E Reference;
+                    std::memcpy(Reference.m_In, L.m_In, sizeof(L.m_In));
+                    QuantizeLanes<simd_scalar>(Reference, nPadded, Q);
+                    for (auto c = 0u; c < E::OUT_COUNT; ++c)
+                        assert(std::memcmp(Reference.m_Out[c], L.m_Out[c], n * sizeof(std::int32_t)) == 0);
+                }
+            #endif
+
+                //
+                // Pack the quantized lanes into the final vertices
+                //
+                for (std::size_t i = 0; i < n; ++i)
                 {
-                    const uint32_t  ov = new_vert_ids[i];
-                    const vertex& v = InputVerts[ov];
+                    const uint32_t  ov       = pInputIds[Base + i];
                     const float     sign_val = BinormalSigns[ov];
                     const uint32_t  sign_bit = (sign_val < 0.0f ? 1u : 0u);
-
-                    // Pos compression
-                    const auto pos = ((v.m_Position - pos_center) / pos_scale + 1.0f) * 32767.5f - 32768.0f;
-                    original_static[i].m_XPos = static_cast<int16_t>(std::round(pos.m_X));
-                    original_static[i].m_YPos = static_cast<int16_t>(std::round(pos.m_Y));
-                    original_static[i].m_ZPos = static_cast<int16_t>(std::round(pos.m_Z));
-
-                    // UV
-                    const auto norm_uv = (v.m_UVs[0] - uv_min) / uv_scale;
-                    original_extras[i].m_UV[0] = static_cast<uint16_t>(std::round(norm_uv.m_X * 65535.0f));
-                    original_extras[i].m_UV[1] = static_cast<uint16_t>(std::round(norm_uv.m_Y * 65535.0f));
-
-                    // Oct normal (12 bits each)
-                    const auto      oct_n   = oct_encode(v.m_Normal.NormalizeSafeCopy());
-                    const uint32_t  n_x     = static_cast<uint32_t>(std::round((oct_n.m_X * 0.5f + 0.5f) * 4095.0f));
-                    const uint32_t  n_y     = static_cast<uint32_t>(std::round((oct_n.m_Y * 0.5f + 0.5f) * 4095.0f));
-
-                    // Oct tangent (12/11 bits)
-                    const auto      oct_t   = oct_encode(v.m_Tangent.NormalizeSafeCopy());
-                    const uint32_t  t_x     = static_cast<uint32_t>(std::round((oct_t.m_X * 0.5f + 0.5f) * 4095.0f));
-                    const uint32_t  t_y     = static_cast<uint32_t>(std::round((oct_t.m_Y * 0.5f + 0.5f) * 2047.0f));
-
-                    // High bits (assuming m_OctNormal is uint8_t[4]: [0]=N_x high, [1]=N_y high, [0]=T_x high, [1]=T_y high)
-                    original_extras[i].m_OctNormal[0]  = static_cast<uint8_t>(n_x >> 4);
-                    original_extras[i].m_OctNormal[1]  = static_cast<uint8_t>(n_y >> 4);
-                    original_extras[i].m_OctTangent[0] = static_cast<uint8_t>(t_x >> 4);
-                    original_extras[i].m_OctTangent[1] = static_cast<uint8_t>(t_y >> 3);
+                    auto&           Static   = pStatic[Base + i];
+                    auto&           Extras   = pExtras[Base + i];
+
+                    Static.m_XPos   = static_cast<int16_t>(L.m_Out[E::OUT_PX][i]);
+                    Static.m_YPos   = static_cast<int16_t>(L.m_Out[E::OUT_PY][i]);
+                    Static.m_ZPos   = static_cast<int16_t>(L.m_Out[E::OUT_PZ][i]);
+                    Extras.m_UV[0]  = static_cast<uint16_t>(L.m_Out[E::OUT_U][i]);
+                    Extras.m_UV[1]  = static_cast<uint16_t>(L.m_Out[E::OUT_V][i]);
+
+                    const uint32_t  n_x     = static_cast<uint32_t>(L.m_Out[E::OUT_NX][i]);
+                    const uint32_t  n_y     = static_cast<uint32_t>(L.m_Out[E::OUT_NY][i]);
+                    const uint32_t  t_x     = static_cast<uint32_t>(L.m_Out[E::OUT_TX][i]);
+                    const uint32_t  t_y     = static_cast<uint32_t>(L.m_Out[E::OUT_TY][i]);
+
+                    // High bits: [0]=X high, [1]=Y high
+                    Extras.m_OctNormal[0]  = static_cast<uint8_t>(n_x >> 4);
+                    Extras.m_OctNormal[1]  = static_cast<uint8_t>(n_y >> 4);
+                    Extras.m_OctTangent[0] = static_cast<uint8_t>(t_x >> 4);
+                    Extras.m_OctTangent[1] = static_cast<uint8_t>(t_y >> 3);
 
                     // Low bits + sign to extra (uint16_t)
                     uint16_t extra_bits = 0u;
@@ -546,316 +1493,2651 @@ void ConvertToCompilerMesh(void)
                     extra_bits |= ((t_x & 0xFu) << 8);         // 8-11: T_x low
                     extra_bits |= ((t_y & 0x7u) << 12);        // 12-14: T_y low
                     extra_bits |= (sign_bit << 15);            // 15: sign
-                    original_static[i].m_Extra = extra_bits;
+                    Static.m_Extra = extra_bits;
 
                     //SANITY CHECK: Decode normal (shader-equivalent)
                     if (false)
                     {
-                        uint32_t high_nx = static_cast<uint32_t>(original_extras[i].m_OctNormal[0]) << 4;
-                        uint32_t high_ny = static_cast<uint32_t>(original_extras[i].m_OctNormal[1]) << 4;
+                        uint32_t high_nx = static_cast<uint32_t>(Extras.m_OctNormal[0]) << 4;
+                        uint32_t high_ny = static_cast<uint32_t>(Extras.m_OctNormal[1]) << 4;
                         uint32_t low_nx = (extra_bits >> 0) & 0xFu;
                         uint32_t low_ny = (extra_bits >> 4) & 0xFu;
                         uint32_t combined_nx = high_nx | low_nx;
                         uint32_t combined_ny = high_ny | low_ny;
                         xmath::fvec2 enc_normal(static_cast<float>(combined_nx) / 4095.0f, static_cast<float>(combined_ny) / 4095.0f);
-                        xmath::fvec3 decoded_normal = oct_decode(enc_normal);  
+                        xmath::fvec3 decoded_normal = oct_decode(enc_normal);
 
-                        xmath::fvec3 orig_normal = v.m_Normal.NormalizeSafeCopy();
+                        xmath::fvec3 orig_normal = InputVerts.getNormal(ov).NormalizeSafeCopy();
                         float error = (decoded_normal - orig_normal).Length();
                         assert(error < 0.01f);
                     }
                 }
+            }
+        }
+
+        //--------------------------------------------------------------------------------------
+        // Culling bounds for clusters too big for meshopt_computeClusterBounds. The sphere
+        // encloses the bbox and the normal cone is disabled (cutoff of 1).
+
+        static void SetBBoxOnlyBounds(geom::cluster& Cluster, const BBox3& bb_pos) noexcept
+        {
+            const xmath::fvec3 Center = (bb_pos.m_MinPos + bb_pos.m_MaxPos) * 0.5f;
+            const float        Radius = (bb_pos.m_MaxPos - bb_pos.m_MinPos).Length() * 0.5f;
+
+            Cluster.m_BoundingSphere    = { Center.m_X, Center.m_Y, Center.m_Z, Radius };
+            Cluster.m_ConeApex          = { Center.m_X, Center.m_Y, Center.m_Z };
+            Cluster.m_ConeAxisCutoff    = { 0, 0, 0, 1 };
+        }
 
-                // Remap vertices and extras
-                std::vector<geom::vertex> remapped_static(new_vert_ids.size());
-                meshopt_remapVertexBuffer(remapped_static.data(), original_static.data(), new_vert_ids.size(), sizeof(geom::vertex), fetch_remap.data());
+        //--------------------------------------------------------------------------------------
+
+        static void SetMeshoptBounds(geom::cluster& Cluster, const meshopt_Bounds& Bounds) noexcept
+        {
+            Cluster.m_BoundingSphere    = { Bounds.center[0],    Bounds.center[1],    Bounds.center[2], Bounds.radius };
+            Cluster.m_ConeApex          = { Bounds.cone_apex[0], Bounds.cone_apex[1], Bounds.cone_apex[2] };
+            Cluster.m_ConeAxisCutoff    = { Bounds.cone_axis[0], Bounds.cone_axis[1], Bounds.cone_axis[2], Bounds.cone_cutoff };
+        }
+
+        //--------------------------------------------------------------------------------------
+        // Collapses the vertices of a cluster that quantized to the same final vertex + extras
+        // (position, uv, oct normal/tangent and sign). The indices and the input ids follow the
+        // survivors, returns the new vertex count.
+
+        static uint32_t WeldQuantizedVerts
+        ( geom::vertex*                     pStatic
+        , geom::vertex_extras*              pExtras
+        , uint32_t*                         pInputIds
+        , uint32_t                          nVerts
+        , unsigned int*                     pIndices
+        , std::size_t                       nIndices
+        , std::vector<unsigned int>&        Remap
+        ) noexcept
+        {
+            const meshopt_Stream Streams[] =
+            { { pStatic, sizeof(geom::vertex),        sizeof(geom::vertex)        }
+            , { pExtras, sizeof(geom::vertex_extras), sizeof(geom::vertex_extras) }
+            };
 
-                std::vector<geom::vertex_extras> remapped_extras(new_vert_ids.size());
-                meshopt_remapVertexBuffer(remapped_extras.data(), original_extras.data(), new_vert_ids.size(), sizeof(geom::vertex_extras), fetch_remap.data());
+            Remap.resize(nVerts);
+            const auto nUnique = static_cast<uint32_t>(meshopt_generateVertexRemapMulti(Remap.data(), pIndices, nIndices, nVerts, Streams, std::size(Streams)));
+            if (nUnique == nVerts) return nVerts;
 
-                // Remap indices
-                meshopt_remapIndexBuffer(local_indices.data(), local_indices.data(), local_indices.size(), fetch_remap.data());
+            meshopt_remapIndexBuffer(pIndices, pIndices, nIndices, Remap.data());
+            meshopt_remapVertexBuffer(pStatic,   pStatic,   nVerts, sizeof(geom::vertex),        Remap.data());
+            meshopt_remapVertexBuffer(pExtras,   pExtras,   nVerts, sizeof(geom::vertex_extras), Remap.data());
+            meshopt_remapVertexBuffer(pInputIds, pInputIds, nVerts, sizeof(uint32_t),            Remap.data());
+            return nUnique;
+        }
 
-                // Append verts to global
-                uint32_t cluster_vert_start = static_cast<uint32_t>(AllStaticVerts.size());
-                AllStaticVerts.insert(AllStaticVerts.end(), remapped_static.begin(), remapped_static.end());
-                AllExtrasVerts.insert(AllExtrasVerts.end(), remapped_extras.begin(), remapped_extras.end());
+        //--------------------------------------------------------------------------------------
+        // Quantizes, optimizes and appends a range of triangles as a new cluster.
+        // Expects S.m_UsedVerts/S.m_VertRemap to be filled by CollectClusterVerts.
 
-                // Append indices to global
-                uint32_t cluster_index_start = static_cast<uint32_t>(AllIndices.size());
-                for (auto idx : local_indices)
+        static void EmitCluster
+        ( const vertex_streams&             InputVerts
+        , const std::vector<uint32_t>&      InputIndices
+        , const std::vector<float>&         BinormalSigns
+        , cluster_scratch&                  S
+        , const cluster_scratch::range      R
+        , const BBox3&                      bb_pos
+        , const BBox2&                      bb_uv
+        , cluster_output&                   Out
+        ) noexcept
+        {
+            auto                            nVerts          = static_cast<uint32_t>(S.m_UsedVerts.size());
+            const std::vector<uint32_t>&    new_vert_ids    = S.m_WeldedIds;
+            const cluster_quantization      Q(bb_pos, bb_uv, S.m_MinPosScale);
+
+            // Build local indices
+            auto& local_indices = S.m_LocalIndices;
+            local_indices.clear();
+            for (uint32_t i = R.m_Begin; i < R.m_End; ++i)
+            {
+                const uint32_t ti = S.m_TriIds[i];
+                for (int j = 0; j < 3; ++j)
                 {
-                    AllIndices.push_back(idx);
+                    local_indices.push_back(S.m_VertRemap[InputIndices[ti * 3 + j]]);
                 }
+            }
 
-                // Create cluster
-                geom::cluster_data  cd;
-                cd.m_PosScaleAndWPADDING.m_X        = pos_scale.m_X;
-                cd.m_PosScaleAndWPADDING.m_Y        = pos_scale.m_Y;
-                cd.m_PosScaleAndWPADDING.m_Z        = pos_scale.m_Z;
-                cd.m_PosTrasnlationAndWPADDING.m_X  = pos_center.m_X;
-                cd.m_PosTrasnlationAndWPADDING.m_Y  = pos_center.m_Y;
-                cd.m_PosTrasnlationAndWPADDING.m_Z  = pos_center.m_Z;
-                cd.m_UVScaleTranslation.m_X         = uv_scale.m_X;
-                cd.m_UVScaleTranslation.m_Y         = uv_scale.m_Y;
-                cd.m_UVScaleTranslation.m_Z         = uv_min.m_X;
-                cd.m_UVScaleTranslation.m_W         = uv_min.m_Y;
-                AllClusterData.push_back(cd);
-
-                geom::cluster       cl;
-                cl.m_BBox                           = bb_pos.to_fbbox();
-                cl.m_iIndex                         = cluster_index_start;
-                cl.m_nIndices                       = static_cast<uint32_t>(c.tri_ids.size() * 3);
-                cl.m_iVertex                        = cluster_vert_start;
-                cl.m_nVertices                      = static_cast<uint32_t>(new_vert_ids.size());
-                OutputClusters.push_back(cl);
+            // Pack original compressed vertices and extras
+            auto& original_static = S.m_OriginalStatic;
+            auto& original_extras = S.m_OriginalExtras;
+            original_static.resize(nVerts);
+            original_extras.resize(nVerts);
+            EncodeVertices(InputVerts, BinormalSigns, S.m_UsedVerts.data(), nVerts, Q, original_static.data(), original_extras.data());
+
+            // Weld what quantized to the same vertex before optimizing the topology
+            S.m_WeldedIds.assign(S.m_UsedVerts.begin(), S.m_UsedVerts.end());
+            if (S.m_bWeld)
+            {
+                const auto nWelded = WeldQuantizedVerts(original_static.data(), original_extras.data(), S.m_WeldedIds.data(), nVerts, local_indices.data(), local_indices.size(), S.m_WeldRemap);
+                Out.m_nWeldedVertices += nVerts - nWelded;
+                nVerts = nWelded;
+            }
+
+            // Optimize vertex cache
+            meshopt_optimizeVertexCache(local_indices.data(), local_indices.data(), local_indices.size(), nVerts);
+
+            // Prepare positions for overdraw optimization
+            auto& local_positions = S.m_LocalPositions;
+            local_positions.resize(nVerts * 3);
+            for (uint32_t i = 0; i < nVerts; ++i)
+            {
+                const auto& pos = InputVerts.m_Position[new_vert_ids[i]];
+                local_positions[i * 3 + 0] = pos.m_X;
+                local_positions[i * 3 + 1] = pos.m_Y;
+                local_positions[i * 3 + 2] = pos.m_Z;
             }
+
+            // Optimize overdraw
+            meshopt_optimizeOverdraw(local_indices.data(), local_indices.data(), local_indices.size(), local_positions.data(), nVerts, sizeof(float) * 3, 1.05f);
+
+            // Culling bounds (meshoptimizer only handles up to 512 triangles per cluster)
+            geom::cluster cl;
+            if (local_indices.size() / 3 <= 512)
+                SetMeshoptBounds(cl, meshopt_computeClusterBounds(local_indices.data(), local_indices.size(), local_positions.data(), nVerts, sizeof(float) * 3));
             else
+                SetBBoxOnlyBounds(cl, bb_pos);
+
+            // Generate fetch remap
+            auto& fetch_remap = S.m_FetchRemap;
+            fetch_remap.resize(nVerts);
+            meshopt_optimizeVertexFetchRemap(fetch_remap.data(), local_indices.data(), local_indices.size(), nVerts);
+
+            // Remap vertices and extras straight into the output
+            const uint32_t cluster_vert_start = static_cast<uint32_t>(Out.m_StaticVerts.size());
+            Out.m_StaticVerts.resize(cluster_vert_start + nVerts);
+            Out.m_ExtrasVerts.resize(cluster_vert_start + nVerts);
+            meshopt_remapVertexBuffer(Out.m_StaticVerts.data() + cluster_vert_start, original_static.data(), nVerts, sizeof(geom::vertex),        fetch_remap.data());
+            meshopt_remapVertexBuffer(Out.m_ExtrasVerts.data() + cluster_vert_start, original_extras.data(), nVerts, sizeof(geom::vertex_extras), fetch_remap.data());
+
+            Out.m_VertexInputIds.resize(cluster_vert_start + nVerts);
+            for (uint32_t i = 0; i < nVerts; ++i)
+                Out.m_VertexInputIds[cluster_vert_start + fetch_remap[i]] = new_vert_ids[i];
+
+            // Remap indices
+            meshopt_remapIndexBuffer(local_indices.data(), local_indices.data(), local_indices.size(), fetch_remap.data());
+
+            // Append indices to the output
+            const uint32_t cluster_index_start = static_cast<uint32_t>(Out.m_Indices.size());
+            Out.m_Indices.insert(Out.m_Indices.end(), local_indices.begin(), local_indices.end());
+
+            // Create cluster
+            Out.m_ClusterData.push_back(Q.getClusterData());
+
+            cl.m_BBox                           = bb_pos.to_fbbox();
+            cl.m_iIndex                         = cluster_index_start;
+            cl.m_nIndices                       = (R.m_End - R.m_Begin) * 3;
+            cl.m_iVertex                        = cluster_vert_start;
+            cl.m_nVertices                      = nVerts;
+            Out.m_Clusters.push_back(cl);
+        }
+
+        //--------------------------------------------------------------------------------------
+        // Breaks a range of triangles (already inside the quantization range) into fixed budget
+        // meshlets. Every meshlet becomes its own cluster with a tighter quantization frame and
+        // the sphere/cone bounds computed by meshoptimizer.
+        // Expects S.m_UsedVerts/S.m_VertRemap to be filled by CollectClusterVerts.
+
+        static void EmitMeshlets
+        ( const vertex_streams&             InputVerts
+        , const std::vector<uint32_t>&      InputIndices
+        , const std::vector<float>&         BinormalSigns
+        , cluster_scratch&                  S
+        , const cluster_scratch::range      R
+        , const std::size_t                 MaxVertices
+        , const std::size_t                 MaxTriangles
+        , const float                       ConeWeight
+        , cluster_output&                   Out
+        ) noexcept
+        {
+            const auto nVerts = static_cast<uint32_t>(S.m_UsedVerts.size());
+
+            // Build local indices and positions
+            auto& local_indices = S.m_LocalIndices;
+            local_indices.clear();
+            for (uint32_t i = R.m_Begin; i < R.m_End; ++i)
             {
-                // Choose split axis based on max extent
-                float   maxes[5]    = { extent_pos.m_X, extent_pos.m_Y, extent_pos.m_Z, extent_uv.m_X, extent_uv.m_Y };
-                int     axis        = 0;
-                float   max_val     = maxes[0];
-                for (int i = 1; i < 5; ++i)
+                const uint32_t ti = S.m_TriIds[i];
+                for (int j = 0; j < 3; ++j)
                 {
-                    if (maxes[i] > max_val)
-                    {
-                        max_val = maxes[i];
-                        axis = i;
-                    }
+                    local_indices.push_back(S.m_VertRemap[InputIndices[ti * 3 + j]]);
                 }
+            }
 
-                float   split_pos;
-                bool    is_pos_axis = (axis < 3);
-                int     sub_axis    = is_pos_axis ? axis : (axis - 3);
-                if (is_pos_axis)
-                {
-                    split_pos = (bb_pos.m_MinPos[sub_axis] + bb_pos.m_MaxPos[sub_axis]) * 0.5f;
-                }
-                else
+            auto& local_positions = S.m_LocalPositions;
+            local_positions.resize(nVerts * 3);
+            for (uint32_t i = 0; i < nVerts; ++i)
+            {
+                const auto& pos = InputVerts.m_Position[S.m_UsedVerts[i]];
+                local_positions[i * 3 + 0] = pos.m_X;
+                local_positions[i * 3 + 1] = pos.m_Y;
+                local_positions[i * 3 + 2] = pos.m_Z;
+            }
+
+            // Build the meshlets
+            const std::size_t MaxMeshlets = meshopt_buildMeshletsBound(local_indices.size(), MaxVertices, MaxTriangles);
+            S.m_Meshlets.resize(MaxMeshlets);
+            S.m_MeshletVertices.resize(MaxMeshlets * MaxVertices);
+            S.m_MeshletTriangles.resize(MaxMeshlets * MaxTriangles * 3);
+
+            const std::size_t nMeshlets = meshopt_buildMeshlets
+            ( S.m_Meshlets.data()
+            , S.m_MeshletVertices.data()
+            , S.m_MeshletTriangles.data()
+            , local_indices.data()
+            , local_indices.size()
+            , local_positions.data()
+            , nVerts
+            , sizeof(float) * 3
+            , MaxVertices
+            , MaxTriangles
+            , ConeWeight
+            );
+
+            for (std::size_t m = 0; m < nMeshlets; ++m)
+            {
+                const meshopt_Meshlet&  Meshlet     = S.m_Meshlets[m];
+                unsigned int*           pVerts      = &S.m_MeshletVertices[Meshlet.vertex_offset];
+                unsigned char*          pTris       = &S.m_MeshletTriangles[Meshlet.triangle_offset];
+
+                // Reorder triangles for the cache and vertices for fetch locality
+                meshopt_optimizeMeshlet(pVerts, pTris, Meshlet.triangle_count, Meshlet.vertex_count);
+
+                // Meshlet bounds (in the original space)
+                geom::cluster cl;
+                SetMeshoptBounds(cl, meshopt_computeMeshletBounds(pVerts, pTris, Meshlet.triangle_count, local_positions.data(), nVerts, sizeof(float) * 3));
+
+                // Tighter quantization frame for the meshlet
+                BBox3 bb_pos;
+                BBox2 bb_uv;
+                S.m_MeshletInputIds.resize(Meshlet.vertex_count);
+                for (unsigned int v = 0; v < Meshlet.vertex_count; ++v)
                 {
-                    split_pos = (bb_uv.m_MinUV[sub_axis] + bb_uv.m_MaxUV[sub_axis]) * 0.5f;
+                    const uint32_t ov = S.m_UsedVerts[pVerts[v]];
+                    S.m_MeshletInputIds[v] = ov;
+                    bb_pos.Update(InputVerts.m_Position[ov]);
+                    bb_uv.Update(InputVerts.getUV(ov));
                 }
+                const cluster_quantization Q(bb_pos, bb_uv, S.m_MinPosScale);
 
-                TriCluster c1, c2;
-                for (uint32_t ti : c.tri_ids)
-                {
-                    uint32_t i0 = InputIndices[ti * 3 + 0];
-                    uint32_t i1 = InputIndices[ti * 3 + 1];
-                    uint32_t i2 = InputIndices[ti * 3 + 2];
-                    float   cent;
+                const uint32_t cluster_vert_start = static_cast<uint32_t>(Out.m_StaticVerts.size());
+                Out.m_StaticVerts.resize(cluster_vert_start + Meshlet.vertex_count);
+                Out.m_ExtrasVerts.resize(cluster_vert_start + Meshlet.vertex_count);
+                EncodeVertices(InputVerts, BinormalSigns, S.m_MeshletInputIds.data(), Meshlet.vertex_count, Q, Out.m_StaticVerts.data() + cluster_vert_start, Out.m_ExtrasVerts.data() + cluster_vert_start);
 
-                    if (is_pos_axis)
-                    {
-                        xmath::fvec3 cent_pos = (InputVerts[i0].m_Position + InputVerts[i1].m_Position + InputVerts[i2].m_Position) / 3.0f;
-                        cent = cent_pos[sub_axis];
-                    }
-                    else
-                    {
-                        xmath::fvec2 cent_uv = (InputVerts[i0].m_UVs[0] + InputVerts[i1].m_UVs[0] + InputVerts[i2].m_UVs[0]) / 3.0f;
-                        cent = cent_uv[sub_axis];
-                    }
+                auto& meshlet_indices = S.m_MeshletIndices;
+                meshlet_indices.assign(pTris, pTris + Meshlet.triangle_count * 3);
 
-                    if (cent < split_pos)   c1.tri_ids.push_back(ti);
-                    else                    c2.tri_ids.push_back(ti);
+                // Weld inside of the meshlet frame, the vertex count can only go down
+                uint32_t nMeshletVerts = Meshlet.vertex_count;
+                if (S.m_bWeld)
+                {
+                    nMeshletVerts = WeldQuantizedVerts(Out.m_StaticVerts.data() + cluster_vert_start, Out.m_ExtrasVerts.data() + cluster_vert_start, S.m_MeshletInputIds.data(), nMeshletVerts, meshlet_indices.data(), meshlet_indices.size(), S.m_WeldRemap);
+                    Out.m_nWeldedVertices += Meshlet.vertex_count - nMeshletVerts;
+                    Out.m_StaticVerts.resize(cluster_vert_start + nMeshletVerts);
+                    Out.m_ExtrasVerts.resize(cluster_vert_start + nMeshletVerts);
                 }
+                Out.m_VertexInputIds.insert(Out.m_VertexInputIds.end(), S.m_MeshletInputIds.begin(), S.m_MeshletInputIds.begin() + nMeshletVerts);
+
+                const uint32_t cluster_index_start = static_cast<uint32_t>(Out.m_Indices.size());
+                Out.m_Indices.insert(Out.m_Indices.end(), meshlet_indices.begin(), meshlet_indices.end());
+
+                Out.m_ClusterData.push_back(Q.getClusterData());
 
-                RecurseClusterSplit(InputVerts, InputIndices, c1, MaxVerts, MaxExtent, BinormalSigns, OutputClusters, AllStaticVerts, AllExtrasVerts, AllClusterData, AllIndices);
-                RecurseClusterSplit(InputVerts, InputIndices, c2, MaxVerts, MaxExtent, BinormalSigns, OutputClusters, AllStaticVerts, AllExtrasVerts, AllClusterData, AllIndices);
+                cl.m_BBox       = bb_pos.to_fbbox();
+                cl.m_iIndex     = cluster_index_start;
+                cl.m_nIndices   = Meshlet.triangle_count * 3;
+                cl.m_iVertex    = cluster_vert_start;
+                cl.m_nVertices  = nMeshletVerts;
+                Out.m_Clusters.push_back(cl);
             }
         }
 
         //--------------------------------------------------------------------------------------
 
-        void ConvertToGeom(float target_precision)
+        struct cluster_params
         {
-            const std::vector<mesh>&            compiler_meshes = m_CompilerMesh;
-            geom&                               result          = m_FinalGeom;
-            std::vector<geom::mesh>             OutMeshes;
-            std::vector<geom::lod>              OutLODs;
-            std::vector<geom::submesh>          OutSubmeshes;
-            std::vector<geom::cluster>          OutClusters;
-            std::vector<geom::vertex>           OutAllStaticVerts;
-            std::vector<geom::vertex_extras>    OutAllExtrasVerts;
-            std::vector<geom::cluster_data>     OutClusterData;
-            std::vector<uint32_t>               OutAllIndices;
-            BBox3                               OutGlobalBBox;
-            std::uint16_t                       current_lod_idx         = 0;
-            std::uint16_t                       current_submesh_idx     = 0;
-            std::uint16_t                       current_cluster_idx     = 0;
-            float                               max_extent              = target_precision * 65535.0f;
+            xgeom_static::cluster_mode          m_Mode              = xgeom_static::cluster_mode::EXTENT_SPLIT;
+            xgeom_static::cluster_partition     m_Partition         = xgeom_static::cluster_partition::MIDPOINT;
+            bool                                m_bMergeClusters    = false;
+            bool                                m_bShareLODVertices = false;
+            bool                                m_bWeldVertices     = true;
+            uint32_t                            m_MaxVerts          = 65534;        // Clusters use 16 bit indices unless wide indices are allowed
+            float                               m_Precision         = 0.001f;       // Position step of the mesh
+            float                               m_MaxExtent         = 65.535f;      // Position quantization range (65535 steps of the precision)
+            float                               m_MaxUVExtent       = 65.535f;      // UV quantization range, fixed whatever the position precision
+            bool                                m_bCompactPositions = false;
+            uint32_t                            m_MeshletMaxVerts   = 64;
+            uint32_t                            m_MeshletMaxTris    = 124;
+            float                               m_MeshletConeWeight = 0.25f;
+        };
 
-            for (const auto& input_mesh : compiler_meshes)
+        //--------------------------------------------------------------------------------------
+        // Split value that leaves half of the centroids of the range on each side
+
+        static float MedianSplit(cluster_scratch& S, const cluster_scratch::range R, int Axis) noexcept
+        {
+            const std::size_t N     = R.m_End - R.m_Begin;
+            float*            pTemp = S.m_FloatTemp.data();
+
+            std::copy(S.m_Centroid[Axis].data() + R.m_Begin, S.m_Centroid[Axis].data() + R.m_End, pTemp);
+            std::nth_element(pTemp, pTemp + N / 2, pTemp + N);
+            return pTemp[N / 2];
+        }
+
+        //--------------------------------------------------------------------------------------
+        // Binned surface area heuristic over the position axes. Returns the best axis and the
+        // split value, or an axis of -1 when every centroid falls in the same spot.
+
+        static std::pair<int, float> SAHSplit(const cluster_scratch& S, const cluster_scratch::range R) noexcept
+        {
+            constexpr int bins_v = 16;
+
+            struct bin
             {
-                BBox3       mesh_bb         = {};
-                float       total_edge_len  = 0.0f;
-                uint32_t    num_edges       = 0;
-                for (const auto& input_sm : input_mesh.m_SubMesh)
+                uint32_t    m_Count = 0;
+                float       m_Min[3] = { std::numeric_limits<float>::max(),    std::numeric_limits<float>::max(),    std::numeric_limits<float>::max()    };
+                float       m_Max[3] = { std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest() };
+
+                void Add(const bin& B) noexcept
                 {
-                    for (const auto& v : input_sm.m_Vertex)
+                    m_Count += B.m_Count;
+                    for (int c = 0; c < 3; ++c)
                     {
-                        mesh_bb.Update(v.m_Position);
-                        OutGlobalBBox.Update(v.m_Position);
+                        m_Min[c] = std::min(m_Min[c], B.m_Min[c]);
+                        m_Max[c] = std::max(m_Max[c], B.m_Max[c]);
                     }
+                }
 
-                    for (size_t ti = 0; ti < input_sm.m_Indices.size() / 3; ++ti)
-                    {
-                        std::uint32_t i1 = input_sm.m_Indices[ti * 3 + 0];
-                        std::uint32_t i2 = input_sm.m_Indices[ti * 3 + 1];
-                        std::uint32_t i3 = input_sm.m_Indices[ti * 3 + 2];
-                        total_edge_len  += (input_sm.m_Vertex[i1].m_Position - input_sm.m_Vertex[i2].m_Position).Length();
-                        total_edge_len  += (input_sm.m_Vertex[i2].m_Position - input_sm.m_Vertex[i3].m_Position).Length();
-                        total_edge_len  += (input_sm.m_Vertex[i3].m_Position - input_sm.m_Vertex[i1].m_Position).Length();
-                        num_edges       += 3;
-                    }
+                float Area(void) const noexcept
+                {
+                    if (m_Count == 0) return 0;
+                    const float dx = m_Max[0] - m_Min[0];
+                    const float dy = m_Max[1] - m_Min[1];
+                    const float dz = m_Max[2] - m_Min[2];
+                    return 2.0f * (dx * dy + dy * dz + dz * dx);
+                }
+            };
+
+            const std::size_t   N           = R.m_End - R.m_Begin;
+            int                 BestAxis    = -1;
+            float               BestSplit   = 0;
+            float               BestCost    = std::numeric_limits<float>::max();
 
-                    for (const auto& lod_in : input_sm.m_LODs)
+            for (int Axis = 0; Axis < 3; ++Axis)
+            {
+                const float* pCentroid = S.m_Centroid[Axis].data() + R.m_Begin;
+                const float  CMin      = ReduceMin(pCentroid, N);
+                const float  CMax      = ReduceMax(pCentroid, N);
+                if (CMax <= CMin) continue;
+
+                const float  Scale     = bins_v / (CMax - CMin);
+                bin          Bins[bins_v];
+
+                for (std::size_t i = 0; i < N; ++i)
+                {
+                    const int   b   = std::min(bins_v - 1, static_cast<int>((pCentroid[i] - CMin) * Scale));
+                    const auto  t   = R.m_Begin + i;
+                    Bins[b].m_Count++;
+                    for (int c = 0; c < 3; ++c)
                     {
-                        for (size_t ti = 0; ti < lod_in.m_Indices.size() / 3; ++ti)
-                        {
-                            std::uint32_t i1 = lod_in.m_Indices[ti * 3 + 0];
-                            std::uint32_t i2 = lod_in.m_Indices[ti * 3 + 1];
-                            std::uint32_t i3 = lod_in.m_Indices[ti * 3 + 2];
-                            total_edge_len  += (input_sm.m_Vertex[i1].m_Position - input_sm.m_Vertex[i2].m_Position).Length();
-                            total_edge_len  += (input_sm.m_Vertex[i2].m_Position - input_sm.m_Vertex[i3].m_Position).Length();
-                            total_edge_len  += (input_sm.m_Vertex[i3].m_Position - input_sm.m_Vertex[i1].m_Position).Length();
-                            num_edges       += 3;
-                        }
+                        Bins[b].m_Min[c] = std::min(Bins[b].m_Min[c], S.m_Min[c][t]);
+                        Bins[b].m_Max[c] = std::max(Bins[b].m_Max[c], S.m_Max[c][t]);
                     }
                 }
 
-                geom::mesh out_m;
-                xstrtool::Copy(out_m.m_Name, input_mesh.m_Name);
-                out_m.m_Name[31]        = '\0';
-                out_m.m_WorldPixelSize  = (num_edges > 0) ? total_edge_len / num_edges : 0.0f;
-                out_m.m_BBox            = mesh_bb.to_fbbox();
-                out_m.m_nLODs           = static_cast<uint16_t>(input_mesh.m_SubMesh.empty() ? 1 : input_mesh.m_SubMesh[0].m_LODs.size() + 1);
-                out_m.m_iLOD            = current_lod_idx;
-                OutMeshes.push_back(out_m);
+                // Sweep from the right to get the cost of every right hand side
+                float RightCost[bins_v];
+                bin   Acc;
+                for (int b = bins_v - 1; b > 0; --b)
+                {
+                    Acc.Add(Bins[b]);
+                    RightCost[b] = Acc.Area() * Acc.m_Count;
+                }
 
-                current_lod_idx += out_m.m_nLODs;
-                for (size_t lod_level = 0; lod_level < out_m.m_nLODs; ++lod_level)
+                Acc = {};
+                for (int b = 0; b < bins_v - 1; ++b)
                 {
-                    geom::lod out_l;
-                    out_l.m_ScreenArea  = (lod_level == 0) ? 1.0f : (input_mesh.m_SubMesh.empty() ? 0.0f : input_mesh.m_SubMesh[0].m_LODs[lod_level - 1].m_ScreenArea);
-                    out_l.m_iSubmesh    = current_submesh_idx;
-                    out_l.m_nSubmesh    = static_cast<uint16_t>(input_mesh.m_SubMesh.size());
-                    OutLODs.push_back(out_l);
+                    Acc.Add(Bins[b]);
+                    if (Acc.m_Count == 0 || Acc.m_Count == N) continue;
 
-                    current_submesh_idx += out_l.m_nSubmesh;
-                    for (const auto& input_sm : input_mesh.m_SubMesh)
+                    const float Cost = Acc.Area() * Acc.m_Count + RightCost[b + 1];
+                    if (Cost < BestCost)
                     {
-                        geom::submesh out_sm;
-                        out_sm.m_iMaterial  = static_cast<uint16_t>(input_sm.m_iMaterial);
-                        out_sm.m_iCluster   = current_cluster_idx;
+                        BestCost  = Cost;
+                        BestAxis  = Axis;
+                        BestSplit = CMin + (b + 1) / Scale;
+                    }
+                }
+            }
 
-                        const std::vector<uint32_t>&  lod_indices     = (lod_level == 0) ? input_sm.m_Indices : ((lod_level - 1 < input_sm.m_LODs.size()) ? input_sm.m_LODs[lod_level - 1].m_Indices : input_sm.m_Indices);
-                        auto                          binormal_signs  = std::vector<float>(input_sm.m_Vertex.size(), 1.0f);
-                        for (size_t i = 0; i < input_sm.m_Vertex.size(); ++i)
-                        {
-                            const vertex& v = input_sm.m_Vertex[i];
-                            if (input_sm.m_bHasBTN)
-                            {
-                                xmath::fvec3    computed_binormal   = xmath::fvec3::Cross(v.m_Normal, v.m_Tangent);
-                                float           dot_val             = xmath::fvec3::Dot(computed_binormal, v.m_Binormal);
-                                binormal_signs[i] = (dot_val >= 0.0f) ? 1.0f : -1.0f;
-                            }
-                        }
-                        TriCluster  initial  = {};
-                        uint32_t    num_tris = static_cast<uint32_t>(lod_indices.size() / 3);
+            return { BestAxis, BestSplit };
+        }
+
+        //--------------------------------------------------------------------------------------
+
+        static void EmitLeaf
+        ( const vertex_streams&             InputVerts
+        , const std::vector<uint32_t>&      InputIndices
+        , const std::vector<float>&         BinormalSigns
+        , const cluster_params&             Params
+        , cluster_scratch&                  S
+        , const cluster_scratch::leaf&      Leaf
+        , cluster_output&                   Out
+        ) noexcept
+        {
+            if (Params.m_Mode != xgeom_static::cluster_mode::EXTENT_SPLIT)
+            {
+                EmitMeshlets(InputVerts, InputIndices, BinormalSigns, S, Leaf.m_Range, Params.m_MeshletMaxVerts, Params.m_MeshletMaxTris, Params.m_MeshletConeWeight, Out);
+            }
+            else
+            {
+                BBox3 bb_pos;
+                BBox2 bb_uv;
+                bb_pos.m_MinPos = xmath::fvec3(Leaf.m_Min[0], Leaf.m_Min[1], Leaf.m_Min[2]);
+                bb_pos.m_MaxPos = xmath::fvec3(Leaf.m_Max[0], Leaf.m_Max[1], Leaf.m_Max[2]);
+                bb_uv.m_MinUV   = xmath::fvec2(Leaf.m_Min[3], Leaf.m_Min[4]);
+                bb_uv.m_MaxUV   = xmath::fvec2(Leaf.m_Max[3], Leaf.m_Max[4]);
+
+                EmitCluster(InputVerts, InputIndices, BinormalSigns, S, Leaf.m_Range, bb_pos, bb_uv, Out);
+            }
+        }
+
+        //--------------------------------------------------------------------------------------
+
+        // Channels 0..2 are the position, 3..4 the UV (see cluster_scratch::Initialize)
+
+        static bool FitsQuantization(const float* pMin, const float* pMax, float MaxExtent, float MaxUVExtent) noexcept
+        {
+            for (int c = 0; c < cluster_scratch::channels_v; ++c)
+            {
+                if ((pMax[c] - pMin[c]) > (c < 3 ? MaxExtent : MaxUVExtent)) return false;
+            }
+            return true;
+        }
+
+        //--------------------------------------------------------------------------------------
+        // Splits the triangles of a submesh into clusters whose extent fits the quantization
+        // range (MaxExtent) and whose vertex count fits MaxVerts. The triangle ids are
+        // partitioned in place and the pending ranges live in an explicit stack, the right
+        // half is pushed first so clusters come out in the same depth first order as a
+        // recursive split would produce them.
+        // In MESHLETS mode only the quantization range drives the split, every resulting
+        // range is then broken into fixed budget meshlets.
+        // When merging is enabled the leaves are first collected, since leaves that follow
+        // each other in depth first order are also contiguous in m_TriIds (and spatial
+        // neighbors), they are greedily merged while the union still fits both budgets.
+
+        static void ClusterSplit
+        ( const vertex_streams&             InputVerts
+        , const std::vector<uint32_t>&      InputIndices
+        , const std::vector<float>&         BinormalSigns
+        , const cluster_params&             Params
+        , cluster_scratch&                  S
+        , cluster_output&                   Out
+        ) noexcept
+        {
+            const auto nTris = static_cast<uint32_t>(InputIndices.size() / 3);
+            if (nTris == 0) return;
+
+            const bool      bMeshlets   = Params.m_Mode != xgeom_static::cluster_mode::EXTENT_SPLIT;
+            const uint32_t  MaxVerts    = bMeshlets ? std::numeric_limits<uint32_t>::max() : Params.m_MaxVerts;
+            const float     MaxExtent   = Params.m_MaxExtent;
+            const float     MaxUVExtent = Params.m_MaxUVExtent;
+
+            S.Initialize(InputVerts, InputIndices, MaxVerts);
+            S.m_Stack.push_back({ 0, nTris });
+
+            while (not S.m_Stack.empty())
+            {
+                cluster_scratch::leaf   Leaf;
+                const auto              R = Leaf.m_Range = S.m_Stack.back();
+                const std::size_t       N = R.m_End - R.m_Begin;
+                S.m_Stack.pop_back();
+
+                // Bounds of the range straight from the triangle tables
+                for (int c = 0; c < cluster_scratch::channels_v; ++c)
+                {
+                    Leaf.m_Min[c] = ReduceMin(S.m_Min[c].data() + R.m_Begin, N);
+                    Leaf.m_Max[c] = ReduceMax(S.m_Max[c].data() + R.m_Begin, N);
+                }
+
+                // A single triangle can not be split any further so it has to become a cluster
+                const bool small_extent = FitsQuantization(Leaf.m_Min, Leaf.m_Max, MaxExtent, MaxUVExtent);
+                if ((small_extent || N == 1) && CollectClusterVerts(InputIndices, S, R, MaxVerts))
+                {
+                    Out.m_nLeafClusters++;
+                    if (Params.m_bMergeClusters) S.m_Leaves.push_back(Leaf);
+                    else                         EmitLeaf(InputVerts, InputIndices, BinormalSigns, Params, S, Leaf, Out);
+                    continue;
+                }
+
+                // Choose split axis based on max extent
+                int     axis        = 0;
+                float   max_val     = Leaf.m_Max[0] - Leaf.m_Min[0];
+                for (int i = 1; i < cluster_scratch::channels_v; ++i)
+                {
+                    if ((Leaf.m_Max[i] - Leaf.m_Min[i]) > max_val)
+                    {
+                        max_val = Leaf.m_Max[i] - Leaf.m_Min[i];
+                        axis = i;
+                    }
+                }
+
+                float split_pos = (Leaf.m_Min[axis] + Leaf.m_Max[axis]) * 0.5f;
+                switch (Params.m_Partition)
+                {
+                case xgeom_static::cluster_partition::MIDPOINT:
+                    break;
+                case xgeom_static::cluster_partition::MEDIAN:
+                    split_pos = MedianSplit(S, R, axis);
+                    break;
+                case xgeom_static::cluster_partition::SAH:
+                    // UV extents are only about quantization so those keep the midpoint split
+                    if (axis < 3)
+                    {
+                        if (auto [SAHAxis, SAHSplitPos] = SAHSplit(S, R); SAHAxis != -1)
+                        {
+                            axis      = SAHAxis;
+                            split_pos = SAHSplitPos;
+                        }
+                    }
+                    break;
+                }
+
+                // Classify the range against the split and partition every table the same way
+                ClassifySide(S.m_Centroid[axis].data() + R.m_Begin, N, split_pos, S.m_Side.data());
+
+                const uint32_t nLeft = R.m_Begin + static_cast<uint32_t>(StablePartition(S.m_TriIds.data() + R.m_Begin, S.m_TriTemp.data(), S.m_Side.data(), N));
+                for (int c = 0; c < cluster_scratch::channels_v; ++c)
+                {
+                    StablePartition(S.m_Centroid[c].data() + R.m_Begin, S.m_FloatTemp.data(), S.m_Side.data(), N);
+                    StablePartition(S.m_Min[c].data()      + R.m_Begin, S.m_FloatTemp.data(), S.m_Side.data(), N);
+                    StablePartition(S.m_Max[c].data()      + R.m_Begin, S.m_FloatTemp.data(), S.m_Side.data(), N);
+                }
+
+                // Degenerated split (all the centroids on one side), fall back to splitting by count
+                uint32_t Mid = nLeft;
+                if (Mid == R.m_Begin || Mid == R.m_End) Mid = R.m_Begin + (R.m_End - R.m_Begin) / 2;
+
+                S.m_Stack.push_back({ Mid, R.m_End });
+                S.m_Stack.push_back({ R.m_Begin, Mid });
+            }
+
+            if (not Params.m_bMergeClusters) return;
+
+            //
+            // Greedy merge of consecutive leaves. The vertex set of the current cluster is kept
+            // in the stamp table so adding a leaf only costs the size of that leaf.
+            //
+            cluster_scratch::leaf Current = S.m_Leaves[0];
+            CollectClusterVerts(InputIndices, S, Current.m_Range, MaxVerts);
+
+            for (std::size_t i = 1; i < S.m_Leaves.size(); ++i)
+            {
+                const auto& Next = S.m_Leaves[i];
+                assert(Next.m_Range.m_Begin == Current.m_Range.m_End);
+
+                cluster_scratch::leaf Merged;
+                Merged.m_Range = { Current.m_Range.m_Begin, Next.m_Range.m_End };
+                for (int c = 0; c < cluster_scratch::channels_v; ++c)
+                {
+                    Merged.m_Min[c] = std::min(Current.m_Min[c], Next.m_Min[c]);
+                    Merged.m_Max[c] = std::max(Current.m_Max[c], Next.m_Max[c]);
+                }
+
+                const std::size_t nPrevVerts = S.m_UsedVerts.size();
+                if (FitsQuantization(Merged.m_Min, Merged.m_Max, MaxExtent, MaxUVExtent) && AppendClusterVerts(InputIndices, S, Next.m_Range, MaxVerts))
+                {
+                    Current = Merged;
+                    continue;
+                }
+
+                // Does not fit, drop whatever was partially added and flush the current cluster
+                S.m_UsedVerts.resize(nPrevVerts);
+                EmitLeaf(InputVerts, InputIndices, BinormalSigns, Params, S, Current, Out);
+
+                Current = Next;
+                CollectClusterVerts(InputIndices, S, Current.m_Range, MaxVerts);
+            }
+
+            EmitLeaf(InputVerts, InputIndices, BinormalSigns, Params, S, Current, Out);
+        }
+
+        //--------------------------------------------------------------------------------------
+        // Clusters a coarse LOD of a submesh on top of the clusters of its LOD0. Every coarse
+        // triangle whose three vertices live in the same LOD0 cluster is re-indexed into that
+        // cluster, those triangles become index-only clusters which reuse the vertex range and
+        // the quantization frame (cluster_data) of the LOD0 cluster. Their m_iVertex is in the
+        // vertex space of Base and they are stored first (Out.m_nSharedClusters). Triangles
+        // that span several LOD0 clusters are clustered normally with their own vertices.
+
+        static void ShareLODClusters
+        ( const vertex_streams&             InputVerts
+        , const std::vector<uint32_t>&      InputIndices
+        , const std::vector<float>&         BinormalSigns
+        , const cluster_params&             Params
+        , const cluster_output&             Base
+        , cluster_scratch&                  S
+        , cluster_output&                   Out
+        ) noexcept
+        {
+            constexpr auto  none_v      = std::numeric_limits<uint32_t>::max();
+            const auto      nInputVerts = InputVerts.size();
+            const auto      nTris       = InputIndices.size() / 3;
+
+            //
+            // Input vertex -> (LOD0 cluster, local index) as a compact CSR table
+            //
+            struct membership
+            {
+                uint32_t    m_iCluster;
+                uint32_t    m_iLocal;
+            };
+
+            std::vector<uint32_t>   MemberOffset(nInputVerts + 1, 0);
+            std::vector<membership> Members(Base.m_VertexInputIds.size());
+
+            for (auto v : Base.m_VertexInputIds) MemberOffset[v + 1]++;
+            for (std::size_t v = 0; v < nInputVerts; ++v) MemberOffset[v + 1] += MemberOffset[v];
+            {
+                std::vector<uint32_t> Cursor(MemberOffset.begin(), MemberOffset.end() - 1);
+                for (uint32_t c = 0; c < Base.m_Clusters.size(); ++c)
+                {
+                    const auto& cl = Base.m_Clusters[c];
+                    for (uint32_t k = 0; k < cl.m_nVertices; ++k)
+                    {
+                        Members[Cursor[Base.m_VertexInputIds[cl.m_iVertex + k]]++] = { c, k };
+                    }
+                }
+            }
+
+            auto FindLocal = [&](uint32_t v, uint32_t iCluster) noexcept -> uint32_t
+            {
+                for (auto i = MemberOffset[v]; i < MemberOffset[v + 1]; ++i)
+                    if (Members[i].m_iCluster == iCluster) return Members[i].m_iLocal;
+                return none_v;
+            };
+
+            //
+            // Assign every coarse triangle to a LOD0 cluster that holds all its vertices
+            //
+            std::vector<uint32_t>   TriCluster(nTris, none_v);
+            std::vector<uint32_t>   TriLocal(nTris * 3);
+            std::vector<uint32_t>   Leftover;
+
+            for (std::size_t t = 0; t < nTris; ++t)
+            {
+                const uint32_t a = InputIndices[t * 3 + 0];
+                const uint32_t b = InputIndices[t * 3 + 1];
+                const uint32_t c = InputIndices[t * 3 + 2];
+
+                for (auto i = MemberOffset[a]; i < MemberOffset[a + 1]; ++i)
+                {
+                    const auto iCluster = Members[i].m_iCluster;
+                    const auto lb       = FindLocal(b, iCluster);
+                    if (lb == none_v) continue;
+                    const auto lc       = FindLocal(c, iCluster);
+                    if (lc == none_v) continue;
+
+                    TriCluster[t]       = iCluster;
+                    TriLocal[t * 3 + 0] = Members[i].m_iLocal;
+                    TriLocal[t * 3 + 1] = lb;
+                    TriLocal[t * 3 + 2] = lc;
+                    break;
+                }
+
+                if (TriCluster[t] == none_v)
+                    Leftover.insert(Leftover.end(), { a, b, c });
+            }
+
+            //
+            // Bucket the shared triangles by LOD0 cluster (stable) and emit the index-only clusters
+            //
+            std::vector<uint32_t> BucketOffset(Base.m_Clusters.size() + 1, 0);
+            for (auto c : TriCluster) if (c != none_v) BucketOffset[c + 1]++;
+            for (std::size_t c = 0; c < Base.m_Clusters.size(); ++c) BucketOffset[c + 1] += BucketOffset[c];
+
+            std::vector<uint32_t> BucketTris(BucketOffset.back());
+            {
+                std::vector<uint32_t> Cursor(BucketOffset.begin(), BucketOffset.end() - 1);
+                for (uint32_t t = 0; t < nTris; ++t)
+                    if (TriCluster[t] != none_v) BucketTris[Cursor[TriCluster[t]]++] = t;
+            }
+
+            const std::size_t   MaxTrisPerCluster   = (Params.m_Mode != xgeom_static::cluster_mode::EXTENT_SPLIT) ? Params.m_MeshletMaxTris : std::numeric_limits<std::size_t>::max();
+            std::vector<uint32_t> LocalStamp;
+            uint32_t              Stamp = 0;
+
+            for (uint32_t c = 0; c < Base.m_Clusters.size(); ++c)
+            {
+                const auto& BaseCluster = Base.m_Clusters[c];
+                const auto  nBaseVerts  = BaseCluster.m_nVertices;
+
+                if (BucketOffset[c] == BucketOffset[c + 1]) continue;
+
+                auto& local_positions = S.m_LocalPositions;
+                local_positions.resize(nBaseVerts * 3);
+                for (uint32_t k = 0; k < nBaseVerts; ++k)
+                {
+                    const auto& pos = InputVerts.m_Position[Base.m_VertexInputIds[BaseCluster.m_iVertex + k]];
+                    local_positions[k * 3 + 0] = pos.m_X;
+                    local_positions[k * 3 + 1] = pos.m_Y;
+                    local_positions[k * 3 + 2] = pos.m_Z;
+                }
+                LocalStamp.assign(nBaseVerts, 0);
+
+                for (auto iBegin = BucketOffset[c]; iBegin < BucketOffset[c + 1]; )
+                {
+                    const auto iEnd = static_cast<uint32_t>(std::min<std::size_t>(BucketOffset[c + 1], iBegin + MaxTrisPerCluster));
+
+                    auto& local_indices = S.m_LocalIndices;
+                    local_indices.clear();
+                    BBox3 bb_pos;
+                    ++Stamp;
+                    for (auto i = iBegin; i < iEnd; ++i)
+                    {
+                        for (int j = 0; j < 3; ++j)
+                        {
+                            const auto l = TriLocal[BucketTris[i] * 3 + j];
+                            local_indices.push_back(l);
+                            bb_pos.Update(InputVerts.m_Position[Base.m_VertexInputIds[BaseCluster.m_iVertex + l]]);
+                            if (LocalStamp[l] != Stamp)
+                            {
+                                LocalStamp[l] = Stamp;
+                                Out.m_nSharedVertexBytes += sizeof(geom::vertex) + sizeof(geom::vertex_extras);
+                            }
+                        }
+                    }
+
+                    meshopt_optimizeVertexCache(local_indices.data(), local_indices.data(), local_indices.size(), nBaseVerts);
+
+                    geom::cluster cl;
+                    if (local_indices.size() / 3 <= 512)
+                        SetMeshoptBounds(cl, meshopt_computeClusterBounds(local_indices.data(), local_indices.size(), local_positions.data(), nBaseVerts, sizeof(float) * 3));
+                    else
+                        SetBBoxOnlyBounds(cl, bb_pos);
+
+                    const uint32_t cluster_index_start = static_cast<uint32_t>(Out.m_Indices.size());
+                    Out.m_Indices.insert(Out.m_Indices.end(), local_indices.begin(), local_indices.end());
+                    Out.m_ClusterData.push_back(Base.m_ClusterData[c]);
+
+                    cl.m_BBox       = bb_pos.to_fbbox();
+                    cl.m_iIndex     = cluster_index_start;
+                    cl.m_nIndices   = static_cast<uint32_t>(local_indices.size());
+                    cl.m_iVertex    = BaseCluster.m_iVertex;
+                    cl.m_nVertices  = nBaseVerts;
+                    Out.m_Clusters.push_back(cl);
+                    Out.m_nSharedClusters++;
+
+                    iBegin = iEnd;
+                }
+            }
+
+            //
+            // Whatever is left gets its own vertices
+            //
+            ClusterSplit(InputVerts, Leftover, BinormalSigns, Params, S, Out);
+        }
+
+        //--------------------------------------------------------------------------------------
+        // Continuous LOD as a DAG of clusters. The submesh is first split into meshlets, then
+        // level by level the clusters are partitioned into small groups of neighbors, every
+        // group is simplified to half its triangles with its border locked (so it still
+        // matches whatever its neighbors get replaced with) and split back into meshlets.
+        // Every cluster keeps the bounds and error of the group it came from and of the group
+        // it was simplified into, geom::SelectClusterCut uses those to pick a crack free cut.
+        // Groups that can not be simplified any further stay as roots of the DAG.
+
+        static void BuildClusterDAG
+        ( const vertex_streams&             InputVerts
+        , const std::vector<uint32_t>&      InputIndices
+        , const std::vector<float>&         BinormalSigns
+        , const cluster_params&             Params
+        , cluster_scratch&                  S
+        , cluster_output&                   Out
+        ) noexcept
+        {
+            struct dag_cluster
+            {
+                std::vector<uint32_t>   m_Indices;                                              // Input vertex indices
+                geom::vec4              m_Sphere;
+                float                   m_Error         = 0;
+                geom::vec4              m_ParentSphere  = { 0, 0, 0, 0 };
+                float                   m_ParentError   = std::numeric_limits<float>::max();
+            };
+
+            constexpr std::size_t   group_size_v    = 4;
+            constexpr auto          none_v          = std::numeric_limits<uint32_t>::max();
+            const std::size_t       nVerts          = InputVerts.size();
+
+            if (InputIndices.empty()) return;
+
+            const float*            pPositions      = InputVerts.getPositions();
+            constexpr std::size_t   PositionStride  = vertex_streams::position_stride_v;
+
+            std::vector<dag_cluster>    Clusters;
+            std::vector<uint32_t>       LocalRemap(nVerts, none_v);
+            std::vector<uint32_t>       LocalToInput;
+            std::vector<uint32_t>       LocalIndices;
+            std::vector<float>          LocalPositions;
+
+            //
+            // Splits a list of triangles into meshlets. The meshlets are built in a compact local
+            // vertex space so the cost depends on the size of the list and not of the submesh.
+            //
+            auto AddMeshlets = [&](const std::vector<uint32_t>& Indices, const geom::vec4* pGroupSphere, float Error)
+            {
+                LocalToInput.clear();
+                LocalIndices.resize(Indices.size());
+                for (std::size_t i = 0; i < Indices.size(); ++i)
+                {
+                    auto& L = LocalRemap[Indices[i]];
+                    if (L == none_v)
+                    {
+                        L = static_cast<uint32_t>(LocalToInput.size());
+                        LocalToInput.push_back(Indices[i]);
+                    }
+                    LocalIndices[i] = L;
+                }
+
+                LocalPositions.resize(LocalToInput.size() * 3);
+                for (std::size_t v = 0; v < LocalToInput.size(); ++v)
+                {
+                    const auto& P = InputVerts.m_Position[LocalToInput[v]];
+                    LocalPositions[v * 3 + 0] = P.m_X;
+                    LocalPositions[v * 3 + 1] = P.m_Y;
+                    LocalPositions[v * 3 + 2] = P.m_Z;
+                    LocalRemap[LocalToInput[v]] = none_v;
+                }
+
+                const std::size_t MaxMeshlets = meshopt_buildMeshletsBound(LocalIndices.size(), Params.m_MeshletMaxVerts, Params.m_MeshletMaxTris);
+                S.m_Meshlets.resize(MaxMeshlets);
+                S.m_MeshletVertices.resize(MaxMeshlets * Params.m_MeshletMaxVerts);
+                S.m_MeshletTriangles.resize(MaxMeshlets * Params.m_MeshletMaxTris * 3);
+
+                const std::size_t nMeshlets = meshopt_buildMeshlets
+                ( S.m_Meshlets.data()
+                , S.m_MeshletVertices.data()
+                , S.m_MeshletTriangles.data()
+                , LocalIndices.data()
+                , LocalIndices.size()
+                , LocalPositions.data()
+                , LocalToInput.size()
+                , sizeof(float) * 3
+                , Params.m_MeshletMaxVerts
+                , Params.m_MeshletMaxTris
+                , Params.m_MeshletConeWeight
+                );
+
+                for (std::size_t m = 0; m < nMeshlets; ++m)
+                {
+                    const meshopt_Meshlet&  Meshlet = S.m_Meshlets[m];
+                    const unsigned int*     pVerts  = &S.m_MeshletVertices[Meshlet.vertex_offset];
+                    const unsigned char*    pTris   = &S.m_MeshletTriangles[Meshlet.triangle_offset];
+                    auto&                   C       = Clusters.emplace_back();
+
+                    C.m_Error = Error;
+                    C.m_Indices.resize(Meshlet.triangle_count * 3);
+                    for (unsigned int i = 0; i < Meshlet.triangle_count * 3; ++i)
+                        C.m_Indices[i] = LocalToInput[pVerts[pTris[i]]];
+
+                    if (pGroupSphere)
+                    {
+                        C.m_Sphere = *pGroupSphere;
+                    }
+                    else
+                    {
+                        const auto Bounds = meshopt_computeClusterBounds(C.m_Indices.data(), C.m_Indices.size(), pPositions, nVerts, PositionStride);
+                        C.m_Sphere = { Bounds.center[0], Bounds.center[1], Bounds.center[2], Bounds.radius };
+                    }
+                }
+            };
+
+            AddMeshlets(InputIndices, nullptr, 0);
+
+            //
+            // Build the levels
+            //
+            std::vector<uint32_t> Pending(Clusters.size());
+            for (uint32_t i = 0; i < Pending.size(); ++i) Pending[i] = i;
+
+            std::vector<uint32_t> ClusterIndices, ClusterIndexCounts, Partition, Merged, Simplified;
+            Out.m_nDAGLevels = 1;
+
+            while (Pending.size() > 1)
+            {
+                ClusterIndices.clear();
+                ClusterIndexCounts.clear();
+                for (auto c : Pending)
+                {
+                    ClusterIndices.insert(ClusterIndices.end(), Clusters[c].m_Indices.begin(), Clusters[c].m_Indices.end());
+                    ClusterIndexCounts.push_back(static_cast<uint32_t>(Clusters[c].m_Indices.size()));
+                }
+
+                Partition.resize(Pending.size());
+                const std::size_t nGroups = meshopt_partitionClusters
+                ( Partition.data()
+                , ClusterIndices.data()
+                , ClusterIndices.size()
+                , ClusterIndexCounts.data()
+                , Pending.size()
+                , pPositions
+                , nVerts
+                , PositionStride
+                , group_size_v
+                );
+
+                std::vector<std::vector<uint32_t>> Groups(nGroups);
+                for (std::size_t i = 0; i < Pending.size(); ++i)
+                    Groups[Partition[i]].push_back(Pending[i]);
+
+                std::vector<uint32_t> NextPending;
+                for (const auto& Group : Groups)
+                {
+                    // Merge the triangles, the error and the bounds of the group
+                    Merged.clear();
+                    float   BaseError   = 0;
+                    BBox3   SphereBox;
+                    for (auto c : Group)
+                    {
+                        const auto& C = Clusters[c];
+                        Merged.insert(Merged.end(), C.m_Indices.begin(), C.m_Indices.end());
+                        BaseError = std::max(BaseError, C.m_Error);
+                        SphereBox.Update(xmath::fvec3(C.m_Sphere.m_X - C.m_Sphere.m_W, C.m_Sphere.m_Y - C.m_Sphere.m_W, C.m_Sphere.m_Z - C.m_Sphere.m_W));
+                        SphereBox.Update(xmath::fvec3(C.m_Sphere.m_X + C.m_Sphere.m_W, C.m_Sphere.m_Y + C.m_Sphere.m_W, C.m_Sphere.m_Z + C.m_Sphere.m_W));
+                    }
+
+                    // Sphere that encloses the spheres of all the children
+                    const xmath::fvec3  Center      = (SphereBox.m_MinPos + SphereBox.m_MaxPos) * 0.5f;
+                    float               Radius      = 0;
+                    for (auto c : Group)
+                    {
+                        const auto& Sp = Clusters[c].m_Sphere;
+                        Radius = std::max(Radius, (xmath::fvec3(Sp.m_X, Sp.m_Y, Sp.m_Z) - Center).Length() + Sp.m_W);
+                    }
+                    const geom::vec4 GroupSphere = { Center.m_X, Center.m_Y, Center.m_Z, Radius };
+
+                    // Simplify to half the triangles without touching the group border
+                    Simplified.resize(Merged.size());
+                    float               ResultError = 0;
+                    const std::size_t   Target      = (Merged.size() / 6) * 3;
+                    const std::size_t   nSimplified = meshopt_simplify
+                    ( Simplified.data()
+                    , Merged.data()
+                    , Merged.size()
+                    , pPositions
+                    , nVerts
+                    , PositionStride
+                    , Target
+                    , std::numeric_limits<float>::max()
+                    , meshopt_SimplifyLockBorder | meshopt_SimplifySparse | meshopt_SimplifyErrorAbsolute
+                    , &ResultError
+                    );
+
+                    // Not enough progress, these clusters stay as roots
+                    if (nSimplified == 0 || nSimplified > Merged.size() * 85 / 100)
+                        continue;
+
+                    Simplified.resize(nSimplified);
+
+                    const float Error = BaseError + ResultError;
+                    for (auto c : Group)
+                    {
+                        Clusters[c].m_ParentSphere = GroupSphere;
+                        Clusters[c].m_ParentError  = Error;
+                    }
+
+                    const auto iFirst = static_cast<uint32_t>(Clusters.size());
+                    AddMeshlets(Simplified, &GroupSphere, Error);
+                    for (auto c = iFirst; c < Clusters.size(); ++c) NextPending.push_back(c);
+                }
+
+                if (NextPending.empty()) break;
+                Out.m_nDAGLevels++;
+
+                // Guard against a level that did not reduce the cluster count
+                if (NextPending.size() >= Pending.size()) break;
+                Pending = std::move(NextPending);
+            }
+
+            //
+            // Emit every cluster of every level, the triangle tables are built once for all of them
+            //
+            std::vector<uint32_t>                   AllIndices;
+            std::vector<cluster_scratch::range>     Ranges;
+            Ranges.reserve(Clusters.size());
+            for (const auto& C : Clusters)
+            {
+                const auto iTri = static_cast<uint32_t>(AllIndices.size() / 3);
+                AllIndices.insert(AllIndices.end(), C.m_Indices.begin(), C.m_Indices.end());
+                Ranges.push_back({ iTri, static_cast<uint32_t>(AllIndices.size() / 3) });
+            }
+
+            S.Initialize(InputVerts, AllIndices, Params.m_MeshletMaxVerts);
+
+            for (std::size_t c = 0; c < Clusters.size(); ++c)
+            {
+                const auto          R = Ranges[c];
+                const std::size_t   N = R.m_End - R.m_Begin;
+                const auto&         C = Clusters[c];
+
+                CollectClusterVerts(AllIndices, S, R, std::numeric_limits<uint32_t>::max());
+
+                float Min[cluster_scratch::channels_v], Max[cluster_scratch::channels_v];
+                for (int ch = 0; ch < cluster_scratch::channels_v; ++ch)
+                {
+                    Min[ch] = ReduceMin(S.m_Min[ch].data() + R.m_Begin, N);
+                    Max[ch] = ReduceMax(S.m_Max[ch].data() + R.m_Begin, N);
+                }
+
+                BBox3 bb_pos;
+                BBox2 bb_uv;
+                bb_pos.m_MinPos = xmath::fvec3(Min[0], Min[1], Min[2]);
+                bb_pos.m_MaxPos = xmath::fvec3(Max[0], Max[1], Max[2]);
+                bb_uv.m_MinUV   = xmath::fvec2(Min[3], Min[4]);
+                bb_uv.m_MaxUV   = xmath::fvec2(Max[3], Max[4]);
+
+                EmitCluster(InputVerts, AllIndices, BinormalSigns, S, R, bb_pos, bb_uv, Out);
+
+                geom::cluster_lod L;
+                L.m_Sphere          = C.m_Sphere;
+                L.m_Error           = C.m_Error;
+                L.m_ParentSphere    = C.m_ParentSphere;
+                L.m_ParentError     = C.m_ParentError;
+                Out.m_ClusterLOD.push_back(L);
+            }
+        }
+
+        //--------------------------------------------------------------------------------------
+
+        struct cluster_job
+        {
+            const sub_mesh*                     m_pSubMesh          = nullptr;
+            const std::vector<uint32_t>*        m_pIndices          = nullptr;
+            const std::vector<float>*           m_pBinormalSigns    = nullptr;
+            std::size_t                         m_iVertexSource     = ~std::size_t(0);  // Job that owns the vertices of the shared clusters (LOD0)
+            std::size_t                         m_iLOD              = 0;
+            std::size_t                         m_iMesh             = 0;
+            const uint32_t*                     m_pChunkTris        = nullptr;          // Spatial chunk of m_pIndices (triangle ids) in the streaming mode
+            std::size_t                         m_nChunkTris        = 0;
+            bool                                m_bContinue         = false;            // Chunk that adds its clusters to the submesh of the previous job
+            bool                                m_bSpilled          = false;            // m_Output was written to the spill folder
+            cluster_output                      m_Output            = {};
+        };
+
+        //--------------------------------------------------------------------------------------
+        // Streaming mode (descriptor m_MemoryBudgetMB). Big submeshes are cut in spatial chunks
+        // that cluster independently, the clustering runs in waves that fit in the budget and
+        // every finished job is spilled to disk until the final geom is assembled. A compiler
+        // mesh is released as soon as all of its jobs are spilled. The budget only bounds the
+        // clustering working set, the final geom (and its encoded copy) is still built in memory.
+
+        inline static constexpr std::size_t streaming_bytes_per_tri_v = 3 * sizeof(uint32_t) + sizeof(geom::vertex) + sizeof(geom::vertex_extras) + sizeof(uint32_t);
+
+        static void ReleaseCompilerMesh(mesh& Mesh) noexcept
+        {
+            // Only the material of the submeshes is read once the clusters are spilled
+            for (auto& Sm : Mesh.m_SubMesh)
+            {
+                Sm.m_Vertex  = {};
+                Sm.m_Indices = {};
+                for (auto& L : Sm.m_LODs) L.m_Indices = {};
+            }
+        }
+
+        //--------------------------------------------------------------------------------------
+
+        static std::size_t EstimateJobBytes(const cluster_job& Job) noexcept
+        {
+            const std::size_t nTris = Job.m_pChunkTris ? Job.m_nChunkTris : Job.m_pIndices->size() / 3;
+            return nTris * streaming_bytes_per_tri_v + Job.m_pSubMesh->m_Vertex.size() * 4 * sizeof(uint32_t);
+        }
+
+        //--------------------------------------------------------------------------------------
+        // Median split of the triangle centroids along the longest axis until every chunk
+        // has at most MaxTris. Chunks are ranges of Order and come out in spatial order.
+
+        static void SpatialChunks(const sub_mesh& SubMesh, const std::vector<uint32_t>& Indices, std::size_t MaxTris, std::vector<uint32_t>& Order, std::vector<std::pair<std::size_t, std::size_t>>& Chunks)
+        {
+            const std::size_t                   nTris = Indices.size() / 3;
+            std::vector<std::array<float, 3>>   Centroids(nTris);
+
+            Order.resize(nTris);
+            for (std::size_t t = 0; t < nTris; ++t)
+            {
+                const auto& A = SubMesh.m_Vertex.m_Position[Indices[t * 3 + 0]];
+                const auto& B = SubMesh.m_Vertex.m_Position[Indices[t * 3 + 1]];
+                const auto& C = SubMesh.m_Vertex.m_Position[Indices[t * 3 + 2]];
+                Centroids[t] = { (A.m_X + B.m_X + C.m_X) / 3, (A.m_Y + B.m_Y + C.m_Y) / 3, (A.m_Z + B.m_Z + C.m_Z) / 3 };
+                Order[t]     = static_cast<uint32_t>(t);
+            }
+
+            std::vector<std::pair<std::size_t, std::size_t>> Stack{ { 0, nTris } };
+            while (not Stack.empty())
+            {
+                const auto [Begin, End] = Stack.back();
+                Stack.pop_back();
+
+                if (End - Begin <= MaxTris)
+                {
+                    Chunks.emplace_back(Begin, End);
+                    continue;
+                }
+
+                std::array<float, 3> Min = Centroids[Order[Begin]], Max = Min;
+                for (std::size_t i = Begin; i < End; ++i)
+                {
+                    for (int a = 0; a < 3; ++a)
+                    {
+                        Min[a] = std::min(Min[a], Centroids[Order[i]][a]);
+                        Max[a] = std::max(Max[a], Centroids[Order[i]][a]);
+                    }
+                }
+
+                int Axis = 0;
+                for (int a = 1; a < 3; ++a) if (Max[a] - Min[a] > Max[Axis] - Min[Axis]) Axis = a;
+
+                const std::size_t Mid = Begin + (End - Begin) / 2;
+                std::nth_element(Order.begin() + Begin, Order.begin() + Mid, Order.begin() + End, [&](uint32_t a, uint32_t b)
+                {
+                    return Centroids[a][Axis] < Centroids[b][Axis];
+                });
+
+                // Right first so the left half is processed (and emitted) next
+                Stack.emplace_back(Mid, End);
+                Stack.emplace_back(Begin, Mid);
+            }
+        }
+
+        //--------------------------------------------------------------------------------------
+
+        struct mesh_stats
+        {
+            BBox3                               m_BBox              = {};
+            float                               m_TotalEdgeLen      = 0.0f;
+            uint32_t                            m_nEdges            = 0;
+            std::vector<std::vector<float>>     m_BinormalSigns     = {};   // One per submesh
+        };
+
+        //--------------------------------------------------------------------------------------
+        // Runs Function(i) for i in [0, Count) as scheduler jobs and waits for all of them.
+        // Jobs must only write to their own slot so the result does not depend on the order
+        // in which the scheduler decides to run them. The first exception thrown by a job is
+        // rethrown here once every job is done, it must not escape into the scheduler.
+
+        template< typename T_LAMBDA >
+        static void ParallelFor(std::size_t Count, T_LAMBDA&& Function)
+        {
+            if (Count == 0) return;
+            if (Count == 1)
+            {
+                Function(std::size_t{ 0 });
+                return;
+            }
+
+            std::exception_ptr  Exception;
+            std::mutex          ExceptionLock;
+
+            xscheduler::channel Channel(xscheduler::str_v<"xgeom_static_compiler::ParallelFor">);
+            for (std::size_t i = 0; i < Count; ++i)
+            {
+                Channel.SubmitJob([&Function, &Exception, &ExceptionLock, i]()
+                {
+                    try
+                    {
+                        Function(i);
+                    }
+                    catch (...)
+                    {
+                        std::lock_guard Lock(ExceptionLock);
+                        if (not Exception) Exception = std::current_exception();
+                    }
+                });
+            }
+            Channel.join();
+
+            if (Exception) std::rethrow_exception(Exception);
+        }
+
+        //--------------------------------------------------------------------------------------
+
+        static void ComputeMeshStats(const mesh& input_mesh, mesh_stats& Stats) noexcept
+        {
+            Stats.m_BinormalSigns.resize(input_mesh.m_SubMesh.size());
+
+            for (const auto& input_sm : input_mesh.m_SubMesh)
+            {
+                for (const auto& P : input_sm.m_Vertex.m_Position)
+                {
+                    Stats.m_BBox.Update(P);
+                }
+
+                const auto& Positions = input_sm.m_Vertex.m_Position;
+
+                auto AddEdges = [&](const std::vector<uint32_t>& Indices)
+                {
+                    for (size_t ti = 0; ti < Indices.size() / 3; ++ti)
+                    {
+                        std::uint32_t i1 = Indices[ti * 3 + 0];
+                        std::uint32_t i2 = Indices[ti * 3 + 1];
+                        std::uint32_t i3 = Indices[ti * 3 + 2];
+                        Stats.m_TotalEdgeLen += (Positions[i1] - Positions[i2]).Length();
+                        Stats.m_TotalEdgeLen += (Positions[i2] - Positions[i3]).Length();
+                        Stats.m_TotalEdgeLen += (Positions[i3] - Positions[i1]).Length();
+                        Stats.m_nEdges       += 3;
+                    }
+                };
+
+                AddEdges(input_sm.m_Indices);
+                for (const auto& lod_in : input_sm.m_LODs)
+                    AddEdges(lod_in.m_Indices);
+
+                auto& binormal_signs = Stats.m_BinormalSigns[&input_sm - input_mesh.m_SubMesh.data()];
+                binormal_signs.resize(input_sm.m_Vertex.size(), 1.0f);
+                if (input_sm.m_bHasBTN)
+                {
+                    for (size_t i = 0; i < input_sm.m_Vertex.size(); ++i)
+                        binormal_signs[i] = input_sm.m_Vertex.getBinormalSign(i);
+                }
+            }
+        }
+
+        //--------------------------------------------------------------------------------------
+        // Position step of a mesh. The mesh details can set it, otherwise it follows the average
+        // edge length (m_WorldPixelSize) so dense props keep their detail and big coarse meshes
+        // (terrain) get a wider quantization range and fewer clusters. A mesh can never need more
+        // than its own bounds spread over the 16 bits.
+
+        inline static constexpr float precision_per_edge_v  = 1.0f / 256.0f;
+        inline static constexpr float min_precision_v       = 0.00001f;
+        inline static constexpr float max_precision_v       = 0.05f;
+
+        float getMeshPrecision(const mesh& Mesh, const mesh_stats& Stats, float DefaultPrecision) const noexcept
+        {
+            if (auto it = m_NameToDetail.find(Mesh.m_Name); it != m_NameToDetail.end() && it->second->m_Precision > 0)
+                return it->second->m_Precision;
+
+            if (not m_Descriptor.m_ClusterSettings.m_bAdaptivePrecision || Stats.m_nEdges == 0)
+                return DefaultPrecision;
+
+            const float AvgEdge     = Stats.m_TotalEdgeLen / Stats.m_nEdges;
+            const auto  Extent      = Stats.m_BBox.m_MaxPos - Stats.m_BBox.m_MinPos;
+            const float MaxExtent   = std::max({ Extent.m_X, Extent.m_Y, Extent.m_Z });
+            const float Precision   = std::clamp(AvgEdge * precision_per_edge_v, min_precision_v, max_precision_v);
+
+            // Finer than the bounds need only adds clusters
+            return std::max(Precision, std::min(MaxExtent / 65535.0f, max_precision_v));
+        }
+
+        //--------------------------------------------------------------------------------------
+        // Per mesh cache of the clustering results. The key covers everything that goes into
+        // the clusters of a mesh (its compiler mesh with the LODs already generated and the
+        // cluster settings) so a mesh whose key matches can splice its cached job outputs
+        // straight into the final geom.
+
+        inline static constexpr std::uint32_t mesh_cache_version_v = 3;
+
+        static std::uint64_t HashMesh(const mesh& Mesh, const cluster_params& Params) noexcept
+        {
+            std::uint64_t Hash = HashBytes(&mesh_cache_version_v, sizeof(mesh_cache_version_v));
+            auto Value = [&](const auto& V) { Hash = HashBytes(&V, sizeof(V), Hash); };
+            auto Array = [&](const auto& V) { Value(V.size()); Hash = HashBytes(V.data(), V.size() * sizeof(V[0]), Hash); };
+
+            Value(Params.m_Mode);
+            Value(Params.m_Partition);
+            Value(Params.m_bMergeClusters);
+            Value(Params.m_bShareLODVertices);
+            Value(Params.m_bWeldVertices);
+            Value(Params.m_MaxVerts);
+            Value(Params.m_Precision);
+            Value(Params.m_MaxExtent);
+            Value(Params.m_MaxUVExtent);
+            Value(Params.m_bCompactPositions);
+            Value(Params.m_MeshletMaxVerts);
+            Value(Params.m_MeshletMaxTris);
+            Value(Params.m_MeshletConeWeight);
+
+            Value(Mesh.m_SubMesh.size());
+            for (const auto& S : Mesh.m_SubMesh)
+            {
+                Value(S.m_iMaterial);
+                Value(S.m_nUVs);
+                Value(S.m_bHasBTN);
+
+                // Field by field, the xmath types may carry padding
+                auto Vec3s = [&](const std::vector<xmath::fvec3>& Stream)
+                {
+                    Value(Stream.size());
+                    for (const auto& F : Stream) { Value(F.m_X); Value(F.m_Y); Value(F.m_Z); }
+                };
+
+                Vec3s(S.m_Vertex.m_Position);
+                Vec3s(S.m_Vertex.m_Normal);
+                Vec3s(S.m_Vertex.m_Tangent);
+                Array(S.m_Vertex.m_BinormalSign);
+                for (int i = 0; i < S.m_nUVs; ++i)
+                {
+                    Value(S.m_Vertex.m_UVs[i].size());
+                    for (const auto& UV : S.m_Vertex.m_UVs[i]) { Value(UV.m_X); Value(UV.m_Y); }
+                }
+
+                Array(S.m_Indices);
+                Value(S.m_LODs.size());
+                for (const auto& L : S.m_LODs)
+                {
+                    Value(L.m_ScreenArea);
+                    Array(L.m_Indices);
+                }
+            }
+
+            return Hash;
+        }
+
+        //--------------------------------------------------------------------------------------
+
+        std::wstring getMeshCachePath(std::uint64_t Key) const
+        {
+            return std::format(L"{}\\MeshCache\\{:016x}.bin", m_ResourceLogPath, Key);
+        }
+
+        //--------------------------------------------------------------------------------------
+
+        std::wstring getSpillPath(std::size_t iJob) const
+        {
+            return std::format(L"{}\\Spill\\{:08x}.bin", m_ResourceLogPath, iJob);
+        }
+
+        //--------------------------------------------------------------------------------------
+        // Removes the cache entries that this compile did not use (old versions of the meshes),
+        // the folder would otherwise grow with every edit of the source
+
+        void PruneMeshCache(std::span<const std::uint64_t> UsedKeys)
+        {
+            std::unordered_set<std::wstring> Used;
+            for (auto Key : UsedKeys) Used.insert(std::filesystem::path(getMeshCachePath(Key)).filename().wstring());
+
+            std::error_code Ec;
+            std::size_t     nRemoved = 0;
+            const auto      Folder   = std::filesystem::path(getMeshCachePath(0)).parent_path();
+            for (const auto& E : std::filesystem::directory_iterator(Folder, Ec))
+            {
+                // Temporary files may belong to a compile that is still writing them
+                if (E.path().extension() != L".bin" || Used.contains(E.path().filename().wstring())) continue;
+                if (std::filesystem::remove(E.path(), Ec)) ++nRemoved;
+            }
+
+            if (nRemoved) LogMessage(xresource_pipeline::msg_type::INFO, std::format("Mesh cache: {} stale entries removed", nRemoved));
+        }
+
+        //--------------------------------------------------------------------------------------
+        // Written to a temporary file and renamed into place, another compile of the same
+        // resource (batch mode) may be writing the same entry at the same time
+
+        static void SaveMeshCache(const std::wstring& FileName, std::uint64_t Key, std::span<const cluster_job> Jobs) noexcept
+        {
+            std::error_code Ec;
+            std::filesystem::create_directories(std::filesystem::path(FileName).parent_path(), Ec);
+
+            const auto TempPath = std::filesystem::path(std::format(L"{}.{:x}.tmp", FileName, std::hash<std::thread::id>{}(std::this_thread::get_id())));
+            {
+                snapshot_writer W{ std::ofstream(TempPath, std::ios::binary | std::ios::trunc) };
+                if (not W.m_File) return;
+
+                WriteMeshCache(W, Key, Jobs);
+                W.m_File.close();
+                if (not W.m_File)
+                {
+                    std::filesystem::remove(TempPath, Ec);
+                    return;
+                }
+            }
+
+            std::filesystem::rename(TempPath, std::filesystem::path(FileName), Ec);
+            if (Ec) std::filesystem::remove(TempPath, Ec);
+        }
+
+        //--------------------------------------------------------------------------------------
+
+        static void WriteMeshCache(snapshot_writer& W, std::uint64_t Key, std::span<const cluster_job> Jobs) noexcept
+        {
+            W.Value(mesh_cache_version_v);
+            W.Value(Key);
+            W.Value(static_cast<std::uint64_t>(Jobs.size()));
+            for (const auto& Job : Jobs)
+            {
+                const auto& Out = Job.m_Output;
+                W.Array(Out.m_Clusters);
+                W.Array(Out.m_StaticVerts);
+                W.Array(Out.m_ExtrasVerts);
+                W.Array(Out.m_ClusterData);
+                W.Array(Out.m_Indices);
+                W.Array(Out.m_VertexInputIds);
+                W.Array(Out.m_ClusterLOD);
+                W.Value(Out.m_nLeafClusters);
+                W.Value(Out.m_nSharedClusters);
+                W.Value(Out.m_nSharedVertexBytes);
+                W.Value(Out.m_nDAGLevels);
+                W.Value(Out.m_nWeldedVertices);
+            }
+        }
+
+        //--------------------------------------------------------------------------------------
+
+        static bool LoadMeshCache(const std::wstring& FileName, std::uint64_t Key, std::span<cluster_job> Jobs) noexcept
+        {
+            snapshot_reader R{ std::ifstream(std::filesystem::path(FileName), std::ios::binary) };
+            if (not R.m_File) return false;
+
+            std::uint32_t Version = 0;
+            std::uint64_t FileKey = 0, nJobs = 0;
+            if (not (R.Value(Version) && R.Value(FileKey) && R.Value(nJobs))) return false;
+            if (Version != mesh_cache_version_v || FileKey != Key || nJobs != Jobs.size()) return false;
+
+            for (auto& Job : Jobs)
+            {
+                auto& Out = Job.m_Output;
+                if (not (  R.Array(Out.m_Clusters)
+                        && R.Array(Out.m_StaticVerts)
+                        && R.Array(Out.m_ExtrasVerts)
+                        && R.Array(Out.m_ClusterData)
+                        && R.Array(Out.m_Indices)
+                        && R.Array(Out.m_VertexInputIds)
+                        && R.Array(Out.m_ClusterLOD)
+                        && R.Value(Out.m_nLeafClusters)
+                        && R.Value(Out.m_nSharedClusters)
+                        && R.Value(Out.m_nSharedVertexBytes)
+                        && R.Value(Out.m_nDAGLevels)
+                        && R.Value(Out.m_nWeldedVertices) ))
+                {
+                    for (auto& J : Jobs) J.m_Output = {};
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        //--------------------------------------------------------------------------------------
+        // Accumulates the meshoptimizer analyzers over many index buffers. The raw counters
+        // are added up and the ratios (ACMR, ATVR, overfetch, overdraw) are recomputed from
+        // them so any level (cluster, submesh, lod, asset) can be reported the same way.
+        // Overdraw is optional, meshoptimizer rasterizes into a fixed viewport so it only
+        // means something for whole draws (not for a single cluster scaled to fill it).
+
+        struct analyzer_totals
+        {
+            // cache size, warp size, primitive group size: Generic FIFO, AMD, NVidia, Intel
+            inline static constexpr std::array<std::array<unsigned, 3>, 4>  cache_configs_v = {{ { 16, 0, 0 }, { 14, 64, 128 }, { 32, 32, 32 }, { 128, 0, 0 } }};
+            inline static constexpr std::array<const char*, 4>              cache_names_v   = { "generic", "amd", "nvidia", "intel" };
+            inline static constexpr std::size_t                             vertex_size_v   = sizeof(geom::vertex) + sizeof(geom::vertex_extras);
+
+            std::uint64_t                   m_nTriangles    = 0;
+            std::uint64_t                   m_nVertices     = 0;        // Unique vertices referenced
+            std::array<std::uint64_t, 4>    m_Transformed   = {};
+            std::array<std::uint64_t, 4>    m_Warps         = {};
+            std::uint64_t                   m_BytesFetched  = 0;
+            std::uint64_t                   m_PixelsCovered = 0;
+            std::uint64_t                   m_PixelsShaded  = 0;
+
+            void Analyze(const uint32_t* pIndices, std::size_t nIndices, const float* pPositions, std::size_t nVertices, std::size_t PosStride, bool bOverdraw = true) noexcept
+            {
+                if (nIndices == 0) return;
+
+                std::vector<std::uint8_t> Used(nVertices, 0);
+                for (std::size_t i = 0; i < nIndices; ++i)
+                {
+                    m_nVertices     += Used[pIndices[i]] == 0;
+                    Used[pIndices[i]] = 1;
+                }
+                m_nTriangles += nIndices / 3;
+
+                for (std::size_t c = 0; c < cache_configs_v.size(); ++c)
+                {
+                    const auto Stats = meshopt_analyzeVertexCache(pIndices, nIndices, nVertices, cache_configs_v[c][0], cache_configs_v[c][1], cache_configs_v[c][2]);
+                    m_Transformed[c] += Stats.vertices_transformed;
+                    m_Warps[c]       += Stats.warps_executed;
+                }
+
+                m_BytesFetched += meshopt_analyzeVertexFetch(pIndices, nIndices, nVertices, vertex_size_v).bytes_fetched;
+
+                if (not bOverdraw) return;
+
+                const auto Overdraw = meshopt_analyzeOverdraw(pIndices, nIndices, pPositions, nVertices, PosStride);
+                m_PixelsCovered += Overdraw.pixels_covered;
+                m_PixelsShaded  += Overdraw.pixels_shaded;
+            }
+
+            void Add(const analyzer_totals& T) noexcept
+            {
+                m_nTriangles    += T.m_nTriangles;
+                m_nVertices     += T.m_nVertices;
+                m_BytesFetched  += T.m_BytesFetched;
+                m_PixelsCovered += T.m_PixelsCovered;
+                m_PixelsShaded  += T.m_PixelsShaded;
+                for (std::size_t c = 0; c < cache_configs_v.size(); ++c)
+                {
+                    m_Transformed[c] += T.m_Transformed[c];
+                    m_Warps[c]       += T.m_Warps[c];
+                }
+            }
+
+            meshopt_VertexCacheStatistics getCacheStats(std::size_t c) const noexcept
+            {
+                meshopt_VertexCacheStatistics S = {};
+                S.vertices_transformed  = static_cast<unsigned>(m_Transformed[c]);
+                S.warps_executed        = static_cast<unsigned>(m_Warps[c]);
+                S.acmr                  = m_nTriangles ? float(m_Transformed[c]) / m_nTriangles : 0;
+                S.atvr                  = m_nVertices  ? float(m_Transformed[c]) / m_nVertices  : 0;
+                return S;
+            }
+
+            meshopt_VertexFetchStatistics getFetchStats(void) const noexcept
+            {
+                meshopt_VertexFetchStatistics S = {};
+                S.bytes_fetched = static_cast<unsigned>(m_BytesFetched);
+                S.overfetch     = m_nVertices ? float(m_BytesFetched) / (m_nVertices * vertex_size_v) : 0;
+                return S;
+            }
+
+            meshopt_OverdrawStatistics getOverdrawStats(void) const noexcept
+            {
+                meshopt_OverdrawStatistics S = {};
+                S.pixels_covered = static_cast<unsigned>(m_PixelsCovered);
+                S.pixels_shaded  = static_cast<unsigned>(m_PixelsShaded);
+                S.overdraw       = m_PixelsCovered ? float(m_PixelsShaded) / m_PixelsCovered : 0;
+                return S;
+            }
+
+            std::string ToJSON(void) const
+            {
+                std::string ACMR, ATVR;
+                for (std::size_t c = 0; c < cache_configs_v.size(); ++c)
+                {
+                    const auto S = getCacheStats(c);
+                    ACMR += std::format("{}\"{}\": {:.4f}", c ? ", " : "", cache_names_v[c], S.acmr);
+                    ATVR += std::format("{}\"{}\": {:.4f}", c ? ", " : "", cache_names_v[c], S.atvr);
+                }
+
+                const auto Overdraw = m_PixelsCovered ? std::format(", \"overdraw\": {:.4f}", getOverdrawStats().overdraw) : std::string{};
+                return std::format( "{{ \"triangles\": {}, \"vertices\": {}, \"acmr\": {{ {} }}, \"atvr\": {{ {} }}, \"overfetch\": {:.4f}{} }}"
+                                  , m_nTriangles, m_nVertices, ACMR, ATVR, getFetchStats().overfetch, Overdraw );
+            }
+        };
+
+        //--------------------------------------------------------------------------------------
+
+        struct job_analysis
+        {
+            analyzer_totals     m_Before;       // Source index buffer of the submesh
+            analyzer_totals     m_After;        // All the final clusters of the submesh as one draw
+            analyzer_totals     m_Clusters;     // Every final cluster on its own (no overdraw)
+        };
+
+        //--------------------------------------------------------------------------------------
+        // Runs the analyzers for a clustering job. The final clusters are measured in the
+        // vertex space of the output (the shared LOD clusters in the one of their LOD0 job),
+        // with the positions taken from the input vertex behind every output vertex.
+
+        static void AnalyzeJob(const cluster_job& Job, const cluster_output* pBase, job_analysis& Result) noexcept
+        {
+            const auto& InputVerts  = Job.m_pSubMesh->m_Vertex;
+            const auto& Out         = Job.m_Output;
+
+            if (InputVerts.empty()) return;
+
+            Result.m_Before.Analyze(Job.m_pIndices->data(), Job.m_pIndices->size(), InputVerts.getPositions(), InputVerts.size(), vertex_streams::position_stride_v);
+
+            // Output vertex space: own vertices first then the ones of the LOD0 job
+            const std::size_t       nOwn        = Out.m_VertexInputIds.size();
+            const std::size_t       nBase       = pBase ? pBase->m_VertexInputIds.size() : 0;
+            std::vector<float>      Positions((nOwn + nBase) * 3);
+            auto                    SetPosition = [&](std::size_t i, uint32_t iInput)
+            {
+                const auto& P = InputVerts.m_Position[iInput];
+                Positions[i * 3 + 0] = P.m_X;
+                Positions[i * 3 + 1] = P.m_Y;
+                Positions[i * 3 + 2] = P.m_Z;
+            };
+            for (std::size_t i = 0; i < nOwn;  ++i) SetPosition(i,        Out.m_VertexInputIds[i]);
+            for (std::size_t i = 0; i < nBase; ++i) SetPosition(nOwn + i, pBase->m_VertexInputIds[i]);
+
+            std::vector<uint32_t> AllIndices;
+            std::vector<uint32_t> LocalIndices;
+            AllIndices.reserve(Out.m_Indices.size());
+
+            for (std::size_t c = 0; c < Out.m_Clusters.size(); ++c)
+            {
+                const auto&     cl          = Out.m_Clusters[c];
+                const uint32_t  VertexBase  = cl.m_iVertex + ((c < Out.m_nSharedClusters) ? static_cast<uint32_t>(nOwn) : 0);
+
+                LocalIndices.assign(Out.m_Indices.begin() + cl.m_iIndex, Out.m_Indices.begin() + cl.m_iIndex + cl.m_nIndices);
+                Result.m_Clusters.Analyze(LocalIndices.data(), LocalIndices.size(), Positions.data() + VertexBase * 3, cl.m_nVertices, sizeof(float) * 3, false);
+
+                for (auto i : LocalIndices) AllIndices.push_back(VertexBase + i);
+            }
+
+            Result.m_After.Analyze(AllIndices.data(), AllIndices.size(), Positions.data(), nOwn + nBase, sizeof(float) * 3);
+        }
+
+        //--------------------------------------------------------------------------------------
+        // Writes Stats.json next to Details.txt with the analyzers before and after the cluster
+        // optimizations for every LOD of every mesh, and keeps the asset totals in the members.
+
+        void WriteStatsReport(const std::vector<cluster_job>& Jobs)
+        {
+            std::vector<job_analysis> Analysis(Jobs.size());
+            ParallelFor(Jobs.size(), [&](std::size_t i)
+            {
+                const auto& Job = Jobs[i];
+                AnalyzeJob(Job, (Job.m_iVertexSource == ~std::size_t(0)) ? nullptr : &Jobs[Job.m_iVertexSource].m_Output, Analysis[i]);
+            });
+
+            auto Escape = [](std::string_view Str)
+            {
+                std::string Result;
+                for (auto c : Str)
+                {
+                    if (c == '"' || c == '\\') Result += '\\';
+                    Result += c;
+                }
+                return Result;
+            };
+
+            job_analysis    Total;
+            std::string     Meshes;
+            for (std::size_t i = 0; i < Jobs.size(); )
+            {
+                const auto  iMesh   = Jobs[i].m_iMesh;
+                std::string LODs;
+                while (i < Jobs.size() && Jobs[i].m_iMesh == iMesh)
+                {
+                    const auto      iLOD = Jobs[i].m_iLOD;
+                    job_analysis    LOD;
+                    for (; i < Jobs.size() && Jobs[i].m_iMesh == iMesh && Jobs[i].m_iLOD == iLOD; ++i)
+                    {
+                        LOD.m_Before.Add(Analysis[i].m_Before);
+                        LOD.m_After.Add(Analysis[i].m_After);
+                        LOD.m_Clusters.Add(Analysis[i].m_Clusters);
+                    }
+
+                    Total.m_Before.Add(LOD.m_Before);
+                    Total.m_After.Add(LOD.m_After);
+                    Total.m_Clusters.Add(LOD.m_Clusters);
+
+                    LODs += std::format( "{}\n        {{ \"lod\": {}, \"before\": {}, \"after\": {}, \"clusters\": {} }}"
+                                       , LODs.empty() ? "" : ",", iLOD, LOD.m_Before.ToJSON(), LOD.m_After.ToJSON(), LOD.m_Clusters.ToJSON() );
+                }
+
+                Meshes += std::format( "{}\n    {{ \"name\": \"{}\", \"lods\": [{}\n      ]\n    }}"
+                                     , Meshes.empty() ? "" : ",", Escape(m_CompilerMesh[iMesh].m_Name), LODs );
+            }
+
+            m_VertCacheStats        = Total.m_After.getCacheStats(0);
+            m_VertCacheAMDStats     = Total.m_After.getCacheStats(1);
+            m_VertCacheNVidiaStats  = Total.m_After.getCacheStats(2);
+            m_VertCacheIntelStats   = Total.m_After.getCacheStats(3);
+            m_VertFetchStats        = Total.m_After.getFetchStats();
+            m_OverdrawStats         = Total.m_After.getOverdrawStats();
+
+            std::ofstream File(std::filesystem::path(std::format(L"{}\\Stats.json", m_ResourceLogPath)), std::ios::trunc);
+            if (not File)
+            {
+                LogMessage(xresource_pipeline::msg_type::INFO, "Failed to create Stats.json");
+                return;
+            }
+
+            File << std::format( "{{\n  \"total\": {{ \"before\": {}, \"after\": {}, \"clusters\": {} }},\n  \"meshes\": [{}\n  ]\n}}\n"
+                               , Total.m_Before.ToJSON(), Total.m_After.ToJSON(), Total.m_Clusters.ToJSON(), Meshes );
+
+            LogMessage(xresource_pipeline::msg_type::INFO, std::format( "Vertex cache ACMR (AMD) {:.3f} -> {:.3f}, overfetch {:.3f} -> {:.3f}, overdraw {:.3f} -> {:.3f}"
+                                                                      , Total.m_Before.getCacheStats(1).acmr, m_VertCacheAMDStats.acmr
+                                                                      , Total.m_Before.getFetchStats().overfetch, m_VertFetchStats.overfetch
+                                                                      , Total.m_Before.getOverdrawStats().overdraw, m_OverdrawStats.overdraw ));
+        }
+
+        //--------------------------------------------------------------------------------------
+
+        void ConvertToGeom(float target_precision)
+        {
+            const std::vector<mesh>&            compiler_meshes = m_CompilerMesh;
+            geom&                               result          = m_FinalGeom;
+            std::vector<geom::mesh>             OutMeshes;
+            std::vector<geom::lod>              OutLODs;
+            std::vector<geom::submesh>          OutSubmeshes;
+            std::vector<geom::cluster>          OutClusters;
+            std::vector<geom::vertex>           OutAllStaticVerts;
+            std::vector<geom::vertex_extras>    OutAllExtrasVerts;
+            std::vector<geom::cluster_data>     OutClusterData;
+            std::vector<uint32_t>               OutAllIndices;
+            std::vector<geom::cluster_lod>      OutClusterLODs;
+            BBox3                               OutGlobalBBox;
+            std::uint32_t                       current_lod_idx         = 0;
+            std::uint32_t                       current_submesh_idx     = 0;
+            std::uint32_t                       current_cluster_idx     = 0;
+            cluster_params                      Params;
+
+            Params.m_Mode               = m_Descriptor.m_ClusterSettings.m_Mode;
+            Params.m_MaxExtent          = target_precision * 65535.0f;
+            Params.m_MeshletMaxVerts    = static_cast<uint32_t>(m_Descriptor.m_ClusterSettings.m_MeshletMaxVertices);
+            Params.m_MeshletMaxTris     = static_cast<uint32_t>(m_Descriptor.m_ClusterSettings.m_MeshletMaxTriangles);
+            Params.m_MeshletConeWeight  = m_Descriptor.m_ClusterSettings.m_MeshletConeWeight;
+            Params.m_Partition          = m_Descriptor.m_ClusterSettings.m_Partition;
+            Params.m_bMergeClusters     = m_Descriptor.m_ClusterSettings.m_bMergeClusters;
+            Params.m_bShareLODVertices  = m_Descriptor.m_ClusterSettings.m_bShareLODVertices;
+            Params.m_bWeldVertices      = m_Descriptor.m_ClusterSettings.m_bWeldVertices;
+            Params.m_MaxVerts           = m_Descriptor.m_ClusterSettings.m_bWideIndices ? std::numeric_limits<uint32_t>::max() - 1 : 65534;
+            Params.m_bCompactPositions  = m_Descriptor.m_ClusterSettings.m_bCompactPositions;
+            Params.m_Precision          = target_precision;
+
+            // Streaming mode, the mesh cache and the stats report need every output in memory
+            const std::size_t   BudgetBytes = static_cast<std::size_t>(m_Descriptor.m_MemoryBudgetMB) * 1024 * 1024;
+            const bool          bStreaming  = BudgetBytes > 0;
+            const bool          bMeshCache  = m_Descriptor.m_bMeshCache && not bStreaming;
+            const std::size_t   ChunkTris   = std::max<std::size_t>(std::size_t(1) << 16, BudgetBytes / (8 * streaming_bytes_per_tri_v));
+
+            if (bStreaming && Params.m_bShareLODVertices)
+                LogMessage(xresource_pipeline::msg_type::INFO, "Streaming: ShareLODVertices keeps every LOD chain whole, big submeshes are not chunked and may go over the memory budget");
+
+            //
+            // Gather the per mesh stats (bboxes, edge lengths, binormal signs) in parallel
+            //
+            std::vector<mesh_stats> MeshStats(compiler_meshes.size());
+            ParallelFor(compiler_meshes.size(), [&](std::size_t i)
+            {
+                ComputeMeshStats(compiler_meshes[i], MeshStats[i]);
+            });
+
+            //
+            // Every mesh clusters and quantizes at its own precision
+            //
+            std::vector<cluster_params> MeshParams(compiler_meshes.size(), Params);
+            for (std::size_t i = 0; i < compiler_meshes.size(); ++i)
+            {
+                MeshParams[i].m_Precision = getMeshPrecision(compiler_meshes[i], MeshStats[i], target_precision);
+                MeshParams[i].m_MaxExtent = MeshParams[i].m_Precision * 65535.0f;
+            }
+
+            if (not MeshParams.empty())
+            {
+                const auto [Min, Max] = std::ranges::minmax(MeshParams, {}, &cluster_params::m_Precision);
+                LogMessage(xresource_pipeline::msg_type::INFO, std::format("Position precision: {:.6f} to {:.6f} units", Min.m_Precision, Max.m_Precision));
+            }
+
+            //
+            // Build the tables and collect the clustering jobs in the final order
+            //
+            std::vector<cluster_job>                Jobs;
+            std::vector<std::vector<std::size_t>>   Chains;     // Jobs that must run in order, LOD0 first
+            std::vector<std::pair<std::size_t, std::size_t>> MeshJobs(compiler_meshes.size());
+            std::deque<std::vector<uint32_t>>       ChunkOrders;
+            for (const auto& input_mesh : compiler_meshes)
+            {
+                const auto& Stats       = MeshStats[&input_mesh - compiler_meshes.data()];
+                const auto  MeshJobBase = Jobs.size();
+                auto&       MeshJobRange = MeshJobs[&input_mesh - compiler_meshes.data()];
+                MeshJobRange.first = MeshJobBase;
+
+                // Meshes without vertices still have an inverted (empty) bbox
+                if (Stats.m_BBox.m_MinPos.m_X <= Stats.m_BBox.m_MaxPos.m_X)
+                {
+                    OutGlobalBBox.Update(Stats.m_BBox.m_MinPos);
+                    OutGlobalBBox.Update(Stats.m_BBox.m_MaxPos);
+                }
+
+                geom::mesh out_m;
+                xstrtool::Copy(out_m.m_Name, input_mesh.m_Name);
+                out_m.m_Name[31]        = '\0';
+                out_m.m_WorldPixelSize  = (Stats.m_nEdges > 0) ? Stats.m_TotalEdgeLen / Stats.m_nEdges : 0.0f;
+                out_m.m_BBox            = Stats.m_BBox.to_fbbox();
+                out_m.m_nLODs           = static_cast<uint16_t>(input_mesh.m_SubMesh.empty() ? 1 : input_mesh.m_SubMesh[0].m_LODs.size() + 1);
+                out_m.m_iLOD            = current_lod_idx;
+                OutMeshes.push_back(out_m);
+
+                current_lod_idx += out_m.m_nLODs;
+                for (size_t lod_level = 0; lod_level < out_m.m_nLODs; ++lod_level)
+                {
+                    geom::lod out_l;
+                    out_l.m_ScreenArea  = (lod_level == 0) ? 1.0f : (input_mesh.m_SubMesh.empty() ? 0.0f : input_mesh.m_SubMesh[0].m_LODs[lod_level - 1].m_ScreenArea);
+                    out_l.m_iSubmesh    = current_submesh_idx;
+                    out_l.m_nSubmesh    = static_cast<uint32_t>(input_mesh.m_SubMesh.size());
+                    OutLODs.push_back(out_l);
+
+                    current_submesh_idx += out_l.m_nSubmesh;
+                    for (const auto& input_sm : input_mesh.m_SubMesh)
+                    {
+                        auto& Job = Jobs.emplace_back();
+                        Job.m_pSubMesh       = &input_sm;
+                        Job.m_pIndices       = (lod_level == 0) ? &input_sm.m_Indices : ((lod_level - 1 < input_sm.m_LODs.size()) ? &input_sm.m_LODs[lod_level - 1].m_Indices : &input_sm.m_Indices);
+                        Job.m_pBinormalSigns = &Stats.m_BinormalSigns[&input_sm - input_mesh.m_SubMesh.data()];
+                        Job.m_iLOD           = lod_level;
+                        Job.m_iMesh          = static_cast<std::size_t>(&input_mesh - compiler_meshes.data());
+
+                        const auto iSubmesh = static_cast<std::size_t>(&input_sm - input_mesh.m_SubMesh.data());
+                        if (Params.m_bShareLODVertices && lod_level > 0)
+                        {
+                            Job.m_iVertexSource = MeshJobBase + iSubmesh;
+                            Chains[Chains.size() - input_mesh.m_SubMesh.size() + iSubmesh].push_back(Jobs.size() - 1);
+                        }
+                        else
+                        {
+                            Chains.push_back({ Jobs.size() - 1 });
+                        }
+
+                        // Shared LOD chains need the whole LOD0 output so only the independent jobs are chunked
+                        if (bStreaming && not Params.m_bShareLODVertices && Job.m_pIndices->size() / 3 > ChunkTris)
+                        {
+                            auto&                                               Order = ChunkOrders.emplace_back();
+                            std::vector<std::pair<std::size_t, std::size_t>>    Chunks;
+                            SpatialChunks(input_sm, *Job.m_pIndices, ChunkTris, Order, Chunks);
+
+                            const cluster_job Template = Job;
+                            for (std::size_t c = 0; c < Chunks.size(); ++c)
+                            {
+                                auto& Chunk = c ? Jobs.emplace_back(Template) : Jobs.back();
+                                Chunk.m_pChunkTris  = Order.data() + Chunks[c].first;
+                                Chunk.m_nChunkTris  = Chunks[c].second - Chunks[c].first;
+                                Chunk.m_bContinue   = c > 0;
+                                if (c) Chains.push_back({ Jobs.size() - 1 });
+                            }
+                        }
+                    }
+                }
+
+                MeshJobRange.second = Jobs.size();
+            }
+
+            //
+            // Reuse the cached clusters of the meshes that did not change
+            //
+            std::vector<std::uint64_t>  MeshKeys(compiler_meshes.size(), 0);
+            std::vector<std::uint8_t>   MeshCached(compiler_meshes.size(), 0);
+            if (bMeshCache)
+            {
+                ParallelFor(compiler_meshes.size(), [&](std::size_t i)
+                {
+                    const auto [Begin, End] = MeshJobs[i];
+                    MeshKeys[i]   = HashMesh(compiler_meshes[i], MeshParams[i]);
+                    MeshCached[i] = Begin != End && LoadMeshCache(getMeshCachePath(MeshKeys[i]), MeshKeys[i], std::span(Jobs.data() + Begin, End - Begin));
+                });
+            }
+
+            //
+            // Cluster every (mesh, lod, submesh). Without LOD vertex sharing every job is its own
+            // chain, with it the coarse LODs of a submesh follow its LOD0 in the same chain.
+            //
+            auto RunChain = [&](std::size_t i)
+            {
+                const auto&     Chain       = Chains[i];
+                const auto&     Base        = Jobs[Chain[0]];
+                const auto&     JobParams   = MeshParams[Base.m_iMesh];
+                cluster_scratch Scratch     = {};
+                Scratch.m_bWeld = JobParams.m_bWeldVertices;
+
+                // Half extent of the 16 bit range at the mesh precision
+                if (JobParams.m_bCompactPositions) Scratch.m_MinPosScale = JobParams.m_Precision * 32767.5f;
+
+                if (MeshCached[Base.m_iMesh]) return;
+
+                // A spatial chunk only clusters its own triangles
+                std::vector<uint32_t>           ChunkIndices;
+                const std::vector<uint32_t>*    pIndices = Base.m_pIndices;
+                if (Base.m_pChunkTris)
+                {
+                    ChunkIndices.resize(Base.m_nChunkTris * 3);
+                    for (std::size_t t = 0; t < Base.m_nChunkTris; ++t)
+                        std::copy_n(Base.m_pIndices->data() + Base.m_pChunkTris[t] * 3, 3, ChunkIndices.data() + t * 3);
+                    pIndices = &ChunkIndices;
+                }
+
+                if (Params.m_Mode == xgeom_static::cluster_mode::CLUSTER_DAG && Base.m_iLOD == 0)
+                    BuildClusterDAG(Base.m_pSubMesh->m_Vertex, *pIndices, *Base.m_pBinormalSigns, JobParams, Scratch, Jobs[Chain[0]].m_Output);
+                else
+                    ClusterSplit(Base.m_pSubMesh->m_Vertex, *pIndices, *Base.m_pBinormalSigns, JobParams, Scratch, Jobs[Chain[0]].m_Output);
+
+                for (std::size_t c = 1; c < Chain.size(); ++c)
+                {
+                    auto& Job = Jobs[Chain[c]];
+                    ShareLODClusters(Job.m_pSubMesh->m_Vertex, *Job.m_pIndices, *Job.m_pBinormalSigns, JobParams, Base.m_Output, Scratch, Job.m_Output);
+                }
+            };
+
+            if (not bStreaming)
+            {
+                ParallelFor(Chains.size(), RunChain);
+            }
+            else
+            {
+                std::error_code Ec;
+                std::filesystem::create_directories(std::filesystem::path(getSpillPath(0)).parent_path(), Ec);
+
+                auto ChainBytes = [&](std::size_t i)
+                {
+                    std::size_t Bytes = 0;
+                    for (auto j : Chains[i]) Bytes += EstimateJobBytes(Jobs[j]);
+                    return Bytes;
+                };
+
+                // Chains still to run per mesh, the last one to finish releases the mesh
+                std::vector<std::atomic<std::size_t>> MeshPendingChains(compiler_meshes.size());
+                for (const auto& Chain : Chains) MeshPendingChains[Jobs[Chain[0]].m_iMesh].fetch_add(1, std::memory_order_relaxed);
+
+                // Waves of chains that fit in the budget, every chain spills its jobs when it is done
+                std::size_t nWaves = 0;
+                for (std::size_t Begin = 0; Begin < Chains.size(); ++nWaves)
+                {
+                    std::size_t End = Begin + 1, WaveBytes = ChainBytes(Begin);
+                    while (End < Chains.size() && WaveBytes + ChainBytes(End) <= BudgetBytes)
+                        WaveBytes += ChainBytes(End++);
+
+                    ParallelFor(End - Begin, [&](std::size_t i)
+                    {
+                        RunChain(Begin + i);
+                        for (auto j : Chains[Begin + i])
+                        {
+                            SaveMeshCache(getSpillPath(j), j, std::span<const cluster_job>(&Jobs[j], 1));
+                            Jobs[j].m_Output    = {};
+                            Jobs[j].m_bSpilled  = true;
+                        }
+
+                        const auto iMesh = Jobs[Chains[Begin + i][0]].m_iMesh;
+                        if (MeshPendingChains[iMesh].fetch_sub(1, std::memory_order_acq_rel) == 1)
+                        {
+                            ReleaseCompilerMesh(m_CompilerMesh[iMesh]);
+                            MeshStats[iMesh].m_BinormalSigns = {};
+                        }
+                    });
+
+                    Begin = End;
+                }
+                ChunkOrders.clear();
+
+                LogMessage(xresource_pipeline::msg_type::INFO, std::format("Streaming: {} jobs ({} chunked) in {} waves with a {} MB clustering budget, the final geom is assembled in memory", Jobs.size(), std::ranges::count_if(Jobs, [](const cluster_job& J) { return J.m_pChunkTris != nullptr; }), nWaves, m_Descriptor.m_MemoryBudgetMB));
+            }
+
+            if (bMeshCache)
+            {
+                ParallelFor(compiler_meshes.size(), [&](std::size_t i)
+                {
+                    const auto [Begin, End] = MeshJobs[i];
+                    if (MeshCached[i] || Begin == End) return;
+                    SaveMeshCache(getMeshCachePath(MeshKeys[i]), MeshKeys[i], std::span<const cluster_job>(Jobs.data() + Begin, End - Begin));
+                });
+
+                LogMessage(xresource_pipeline::msg_type::INFO, std::format("Mesh cache: {} of {} meshes reused", std::ranges::count(MeshCached, 1), compiler_meshes.size()));
+
+                PruneMeshCache(MeshKeys);
+            }
+
+            //
+            // Concatenate the jobs in order rebasing their local offsets. Spilled jobs are
+            // read back one at a time and released as soon as they are appended.
+            //
+            std::size_t nClusters = 0, nLeafClusters = 0, nSharedClusters = 0, nSharedBytes = 0, nLevels = 0, nWelded = 0;
+            if (not bStreaming)
+            {
+                std::size_t nVerts = 0, nIndices = 0;
+                for (const auto& Job : Jobs)
+                {
+                    nClusters += Job.m_Output.m_Clusters.size();
+                    nVerts    += Job.m_Output.m_StaticVerts.size();
+                    nIndices  += Job.m_Output.m_Indices.size();
+                }
+                OutClusters.reserve(nClusters);
+                OutClusterData.reserve(nClusters);
+                OutAllStaticVerts.reserve(nVerts);
+                OutAllExtrasVerts.reserve(nVerts);
+                OutAllIndices.reserve(nIndices);
+                OutSubmeshes.reserve(Jobs.size());
+                nClusters = 0;
+            }
+
+            std::vector<uint32_t> JobVertexBase(Jobs.size());
+            for (auto& Job : Jobs)
+            {
+                const auto iJob = static_cast<std::size_t>(&Job - Jobs.data());
+                if (Job.m_bSpilled)
+                {
+                    if (not LoadMeshCache(getSpillPath(iJob), iJob, std::span<cluster_job>(&Job, 1)))
+                        throw std::runtime_error(std::format("Failed to read back the spilled clusters of job {}", iJob));
+                }
+
+                const auto& Out         = Job.m_Output;
+                const auto  VertexBase  = static_cast<uint32_t>(OutAllStaticVerts.size());
+                const auto  IndexBase   = static_cast<uint32_t>(OutAllIndices.size());
+
+                nLeafClusters   += Out.m_nLeafClusters;
+                nSharedClusters += Out.m_nSharedClusters;
+                nSharedBytes    += Out.m_nSharedVertexBytes;
+                nClusters       += Out.m_Clusters.size();
+                nLevels          = std::max(nLevels, Out.m_nDAGLevels);
+                nWelded         += Out.m_nWeldedVertices;
+
+                // Shared clusters point at the vertices of their LOD0 job which is always concatenated first
+                JobVertexBase[iJob] = VertexBase;
+                const auto  SharedBase  = (Job.m_iVertexSource == ~std::size_t(0)) ? VertexBase : JobVertexBase[Job.m_iVertexSource];
+
+                // Spatial chunks extend the submesh of the previous job
+                if (Job.m_bContinue)
+                {
+                    OutSubmeshes.back().m_nCluster += static_cast<uint32_t>(Out.m_Clusters.size());
+                }
+                else
+                {
+                    geom::submesh out_sm;
+                    out_sm.m_iMaterial  = static_cast<uint16_t>(Job.m_pSubMesh->m_iMaterial);
+                    out_sm.m_iCluster   = current_cluster_idx;
+                    out_sm.m_nCluster   = static_cast<uint32_t>(Out.m_Clusters.size());
+                    OutSubmeshes.push_back(out_sm);
+                }
+                current_cluster_idx += static_cast<uint32_t>(Out.m_Clusters.size());
+
+                for (std::size_t c = 0; c < Out.m_Clusters.size(); ++c)
+                {
+                    auto cl = Out.m_Clusters[c];
+                    cl.m_iIndex  += IndexBase;
+                    cl.m_iVertex += (c < Out.m_nSharedClusters) ? SharedBase : VertexBase;
+                    OutClusters.push_back(cl);
+                }
+
+                OutClusterData.insert(OutClusterData.end(), Out.m_ClusterData.begin(), Out.m_ClusterData.end());
+                OutAllStaticVerts.insert(OutAllStaticVerts.end(), Out.m_StaticVerts.begin(), Out.m_StaticVerts.end());
+                OutAllExtrasVerts.insert(OutAllExtrasVerts.end(), Out.m_ExtrasVerts.begin(), Out.m_ExtrasVerts.end());
+                OutAllIndices.insert(OutAllIndices.end(), Out.m_Indices.begin(), Out.m_Indices.end());
+
+                // Clusters outside of the DAG are always part of the cut
+                if (Params.m_Mode == xgeom_static::cluster_mode::CLUSTER_DAG)
+                {
+                    if (Out.m_ClusterLOD.empty())
+                    {
+                        for (const auto& cl : Out.m_Clusters)
+                        {
+                            geom::cluster_lod L;
+                            L.m_Sphere          = cl.m_BoundingSphere;
+                            L.m_Error           = 0;
+                            L.m_ParentSphere    = cl.m_BoundingSphere;
+                            L.m_ParentError     = std::numeric_limits<float>::max();
+                            OutClusterLODs.push_back(L);
+                        }
+                    }
+                    else
+                    {
+                        assert(Out.m_ClusterLOD.size() == Out.m_Clusters.size());
+                        OutClusterLODs.insert(OutClusterLODs.end(), Out.m_ClusterLOD.begin(), Out.m_ClusterLOD.end());
+                    }
+                }
+
+                if (Job.m_bSpilled)
+                {
+                    Job.m_Output = {};
+                    std::error_code Ec;
+                    std::filesystem::remove(std::filesystem::path(getSpillPath(iJob)), Ec);
+                }
+            }
+
+            if (Params.m_bMergeClusters)
+            {
+                LogMessage(xresource_pipeline::msg_type::INFO, std::format("Cluster merge: {} leaf clusters -> {} clusters", nLeafClusters, nClusters));
+            }
+
+            if (Params.m_Mode == xgeom_static::cluster_mode::CLUSTER_DAG)
+            {
+                LogMessage(xresource_pipeline::msg_type::INFO, std::format("Cluster DAG: {} clusters, up to {} levels", nClusters, nLevels));
+            }
+
+            if (Params.m_bShareLODVertices)
+            {
+                LogMessage(xresource_pipeline::msg_type::INFO, std::format("LOD vertex sharing: {} index-only clusters, {} bytes of vertex data saved", nSharedClusters, nSharedBytes));
+            }
+
+            if (Params.m_bWeldVertices)
+            {
+                LogMessage(xresource_pipeline::msg_type::INFO, std::format("Quantized welding: {} vertices collapsed", nWelded));
+            }
+
+            // Meshes and material instances are still 16 bit, everything that scales with the
+            // clustering is 32 bit (see geom::xserializer_version_v)
+            if (OutMeshes.size() > std::numeric_limits<std::uint16_t>::max())
+                throw std::runtime_error(std::format("Too many meshes ({}), the limit is {}", OutMeshes.size(), std::numeric_limits<std::uint16_t>::max()));
+
+            if (m_RawGeom.m_MaterialInstance.size() > std::numeric_limits<std::uint16_t>::max())
+                throw std::runtime_error(std::format("Too many material instances ({}), the limit is {}", m_RawGeom.m_MaterialInstance.size(), std::numeric_limits<std::uint16_t>::max()));
+
+            result.m_nMeshes    = static_cast<std::uint16_t>(OutMeshes.size());
+            result.m_pMesh      = new geom::mesh[result.m_nMeshes];
+            std::ranges::copy(OutMeshes, result.m_pMesh);
+            result.m_nLODs      = static_cast<std::uint32_t>(OutLODs.size());
+            result.m_pLOD       = new geom::lod[result.m_nLODs];
+            std::ranges::copy(OutLODs, result.m_pLOD);
+            result.m_nSubMeshs  = static_cast<std::uint32_t>(OutSubmeshes.size());
+            result.m_pSubMesh   = new geom::submesh[result.m_nSubMeshs];
+            std::ranges::copy(OutSubmeshes, result.m_pSubMesh);
+            result.m_nClusters  = static_cast<std::uint32_t>(OutClusters.size());
+            result.m_pCluster   = new geom::cluster[result.m_nClusters];
+            std::ranges::copy(OutClusters, result.m_pCluster);
+            result.m_nClusterLODs = static_cast<std::uint32_t>(OutClusterLODs.size());
+            result.m_pClusterLOD  = OutClusterLODs.empty() ? nullptr : new geom::cluster_lod[result.m_nClusterLODs];
+            std::ranges::copy(OutClusterLODs, result.m_pClusterLOD);
+            result.m_BBox       = OutGlobalBBox.to_fbbox();
+
+            //
+            // Instances sorted by mesh (see geom::getMeshInstances), the global bbox has to
+            // include every placement
+            //
+            std::ranges::stable_sort(m_Instances, {}, &raw_instance::m_iMesh);
+            result.m_nInstances = static_cast<std::uint32_t>(m_Instances.size());
+            result.m_pInstance  = m_Instances.empty() ? nullptr : new geom::instance[result.m_nInstances];
+            for (std::uint32_t i = 0; i < result.m_nInstances; ++i)
+            {
+                const auto& In  = m_Instances[i];
+                auto&       Out = result.m_pInstance[i];
+                const auto& T   = In.m_Transform;
+                Out.m_iMesh     = static_cast<std::uint16_t>(In.m_iMesh);
+                for (int r = 0; r < 3; ++r) Out.m_Transform[r] = { T[r * 4 + 0], T[r * 4 + 1], T[r * 4 + 2], T[r * 4 + 3] };
+
+                const auto& MeshBBox = OutMeshes[In.m_iMesh].m_BBox;
+                if (MeshBBox.m_Min.m_X > MeshBBox.m_Max.m_X) continue;
+
+                for (int c = 0; c < 8; ++c)
+                {
+                    const xmath::fvec3 P( (c & 1) ? MeshBBox.m_Max.m_X : MeshBBox.m_Min.m_X
+                                        , (c & 2) ? MeshBBox.m_Max.m_Y : MeshBBox.m_Min.m_Y
+                                        , (c & 4) ? MeshBBox.m_Max.m_Z : MeshBBox.m_Min.m_Z );
+                    OutGlobalBBox.Update(xmath::fvec3( T[0] * P.m_X + T[1] * P.m_Y + T[2]  * P.m_Z + T[3]
+                                                     , T[4] * P.m_X + T[5] * P.m_Y + T[6]  * P.m_Z + T[7]
+                                                     , T[8] * P.m_X + T[9] * P.m_Y + T[10] * P.m_Z + T[11] ));
+                }
+            }
+            result.m_BBox       = OutGlobalBBox.to_fbbox();
+            result.m_nVertices  = static_cast<std::uint32_t>(OutAllStaticVerts.size());
+            result.m_nIndices   = static_cast<std::uint32_t>(OutAllIndices.size());
+
+            //
+            // Set all the material instances
+            //
+            result.m_nDefaultMaterialInstances = static_cast<std::uint16_t>(m_RawGeom.m_MaterialInstance.size());
+            result.m_pDefaultMaterialInstances = new xrsc::material_instance_ref[result.m_nDefaultMaterialInstances];
+
+            // Set default values
+            std::memset(result.m_pDefaultMaterialInstances, 0, result.m_nDefaultMaterialInstances * sizeof(*result.m_pDefaultMaterialInstances));
+
+            // Set all the materials that we know about
+            for (auto& E : m_RawGeom.m_MaterialInstance)
+            {
+                const auto Index = static_cast<int>(&E - m_RawGeom.m_MaterialInstance.data());
+                if (int iMaterial = m_Descriptor.findMaterial(E.m_Name); iMaterial != -1)
+                    result.m_pDefaultMaterialInstances[Index] = m_Descriptor.m_MaterialInstRefList[iMaterial];
+            }
+
+            //
+            // Build the final data
+            //
+            // Compute aligned sizes for GPU data
+            auto align = [](std::size_t offset, std::size_t alignment) constexpr -> std::size_t
+            {
+                return (offset + alignment - 1) & ~(alignment - 1);
+            };
+
+            // 32 bit indices only when a cluster really needs them, the budget may allow it
+            // without any cluster going over
+            const bool bIndex32 = std::ranges::any_of(OutClusters, [](const geom::cluster& C) { return C.m_nVertices > 0xffff; });
+            if (bIndex32)
+            {
+                result.m_Flags |= geom::flags_index32_v;
+                LogMessage(xresource_pipeline::msg_type::INFO, "Using 32 bit indices, some clusters have more than 65535 vertices");
+            }
+
+            constexpr std::size_t   vulkan_align    = 64; // Min for Vulkan buffers/UBO
+            const std::size_t       VertexSize      = OutAllStaticVerts.size() * sizeof(geom::vertex);
+            const std::size_t       ExtrasSize      = OutAllExtrasVerts.size() * sizeof(geom::vertex_extras);
+            const std::size_t       IndicesSize     = OutAllIndices.size()     * result.getIndexSize();
+            const std::size_t       ClusterDataSize = OutClusterData.size()    * sizeof(geom::cluster_data);
+
+            std::size_t             current_offset  = 0;
+
+            result.m_VertexOffset           = current_offset; current_offset = align(current_offset + VertexSize,       vulkan_align);
+            result.m_VertexExtrasOffset     = current_offset; current_offset = align(current_offset + ExtrasSize,       vulkan_align);
+            result.m_IndicesOffset          = current_offset; current_offset = align(current_offset + IndicesSize,      vulkan_align);
+            result.m_ClusterDataOffset      = current_offset; current_offset = align(current_offset + ClusterDataSize,  vulkan_align);
+            result.m_DataSize               = current_offset;
+            result.m_DecodedDataSize        = current_offset;
+            result.m_pData                  = new char[result.m_DataSize];
+
+            // Copy data into m_pData, in the streaming mode every array is released as soon as it is copied
+            std::memcpy(result.m_pData + result.m_VertexOffset,         OutAllStaticVerts.data(), VertexSize);
+            if (bStreaming) OutAllStaticVerts = {};
+            std::memcpy(result.m_pData + result.m_VertexExtrasOffset,   OutAllExtrasVerts.data(), ExtrasSize);
+            if (bStreaming) OutAllExtrasVerts = {};
+            std::memcpy(result.m_pData + result.m_ClusterDataOffset,    OutClusterData.data(),    ClusterDataSize);
+            if (bStreaming) OutClusterData = {};
+
+            // Copy the indices
+            if (bIndex32)
+            {
+                std::memcpy(result.m_pData + result.m_IndicesOffset, OutAllIndices.data(), IndicesSize);
+            }
+            else
+            {
+                auto pIndex = reinterpret_cast<std::uint16_t*>(result.m_pData + result.m_IndicesOffset);
+                for (size_t i = 0; i < OutAllIndices.size(); ++i)
+                {
+                    assert(OutAllIndices[i] < 0xffff);
+                    pIndex[i] = static_cast<std::uint16_t>(OutAllIndices[i]);
+                }
+            }
+
+            // Make sure that at least we have one cluster
+            assert(result.m_nClusters >= 1);
+
+            if (m_Descriptor.m_bWriteStatsReport)
+            {
+                if (bStreaming) LogMessage(xresource_pipeline::msg_type::INFO, "Stats report skipped, the cluster outputs were streamed");
+                else            WriteStatsReport(Jobs);
+            }
+        }
+
+        //--------------------------------------------------------------------------------------
+        // Replaces m_pData with the meshopt encoded streams (see geom::flags_encoded_data_v).
+        // Vertex ranges and clusters are encoded as independent jobs and then packed in order.
+
+        void EncodePayload(void)
+        {
+            geom& Geom = m_FinalGeom;
+
+            std::vector<std::pair<std::uint32_t, std::uint32_t>> Ranges;
+            Geom.ForEachVertexRange([&](std::uint32_t iVertex, std::uint32_t nVertices)
+            {
+                Ranges.emplace_back(iVertex, nVertices);
+            });
+
+            const auto                              Clusters    = Geom.getClusters();
+            std::vector<std::vector<unsigned char>> Streams(Ranges.size() * 2 + Clusters.size());
+
+            ParallelFor(Streams.size(), [&](std::size_t i)
+            {
+                auto& Stream = Streams[i];
+                if (i < Ranges.size() * 2)
+                {
+                    const auto [iVertex, nVertices] = Ranges[i / 2];
+                    const bool          bExtras     = (i & 1) != 0;
+                    const std::size_t   Stride      = bExtras ? sizeof(geom::vertex_extras) : sizeof(geom::vertex);
+                    const char*         pSrc        = Geom.m_pData + (bExtras ? Geom.m_VertexExtrasOffset : Geom.m_VertexOffset) + iVertex * Stride;
+
+                    Stream.resize(meshopt_encodeVertexBufferBound(nVertices, Stride));
+                    Stream.resize(meshopt_encodeVertexBuffer(Stream.data(), Stream.size(), pSrc, nVertices, Stride));
+                }
+                else
+                {
+                    const auto&                 C       = Clusters[i - Ranges.size() * 2];
+                    std::vector<std::uint32_t>  Indices;
+                    if (Geom.getIndexSize() == sizeof(std::uint32_t))
+                    {
+                        const auto* pSrc = reinterpret_cast<const std::uint32_t*>(Geom.m_pData + Geom.m_IndicesOffset) + C.m_iIndex;
+                        Indices.assign(pSrc, pSrc + C.m_nIndices);
+                    }
+                    else
+                    {
+                        const auto* pSrc = reinterpret_cast<const std::uint16_t*>(Geom.m_pData + Geom.m_IndicesOffset) + C.m_iIndex;
+                        Indices.assign(pSrc, pSrc + C.m_nIndices);
+                    }
+
+                    Stream.resize(meshopt_encodeIndexBufferBound(C.m_nIndices, C.m_nVertices));
+                    Stream.resize(meshopt_encodeIndexBuffer(Stream.data(), Stream.size(), Indices.data(), Indices.size()));
+                }
+            });
+
+            //
+            // Pack the size table, the streams and the raw cluster data
+            //
+            const std::size_t ClusterDataSize = Geom.m_nClusters * sizeof(geom::cluster_data);
+            std::size_t       EncodedSize     = Streams.size() * sizeof(std::uint32_t) + ClusterDataSize;
+            for (const auto& S : Streams) EncodedSize += S.size();
+
+            char*   pEncoded    = new char[EncodedSize];
+            auto*   pSizes      = reinterpret_cast<std::uint32_t*>(pEncoded);
+            char*   pCursor     = pEncoded + Streams.size() * sizeof(std::uint32_t);
+
+            for (std::size_t i = 0; i < Streams.size(); ++i)
+            {
+                pSizes[i] = static_cast<std::uint32_t>(Streams[i].size());
+                std::memcpy(pCursor, Streams[i].data(), Streams[i].size());
+                pCursor += Streams[i].size();
+            }
+            std::memcpy(pCursor, Geom.m_pData + Geom.m_ClusterDataOffset, ClusterDataSize);
+
+            LogMessage(xresource_pipeline::msg_type::INFO, std::format("Encoded payload: {} bytes -> {} bytes", Geom.m_DataSize, EncodedSize));
+
+            delete[] Geom.m_pData;
+            Geom.m_pData            = pEncoded;
+            Geom.m_DecodedDataSize  = Geom.m_DataSize;
+            Geom.m_DataSize         = EncodedSize;
+            Geom.m_Flags           |= geom::flags_encoded_data_v;
+        }
+
+        //--------------------------------------------------------------------------------------
+
+        //--------------------------------------------------------------------------------------
+        // Mesh edits (deletes and merges) are first collected in a table where every raw mesh
+        // points to the mesh that will own its facets (itself, a merge survivor or none) and
+        // then applied with a single pass over the facets and a single compaction of the
+        // meshes. That keeps the edits linear in facets + meshes no matter how many nodes
+        // the scene has.
+
+        struct mesh_edits
+        {
+            constexpr static int deleted_v = -1;
+
+            explicit mesh_edits(std::size_t nMeshes)
+                : m_Target(nMeshes)
+            {
+                for (int i = 0; i < static_cast<int>(nMeshes); ++i) m_Target[i] = i;
+            }
+
+            bool isAlive(int iMesh) const noexcept { return m_Target[iMesh] == iMesh; }
+
+            std::vector<int>    m_Target;
+        };
+
+        //--------------------------------------------------------------------------------------
+
+        static void ApplyMeshEdits(xraw3d::geom& Geom, const mesh_edits& Edits) noexcept
+        {
+            const int nMeshes = static_cast<int>(Geom.m_Mesh.size());
+
+            // Final index of every mesh, survivors keep their relative order
+            std::vector<int> Remap(nMeshes, mesh_edits::deleted_v);
+            int              nAlive = 0;
+            for (int i = 0; i < nMeshes; ++i)
+                if (Edits.isAlive(i)) Remap[i] = nAlive++;
+
+            for (int i = 0; i < nMeshes; ++i)
+            {
+                const int T = Edits.m_Target[i];
+                if (T != mesh_edits::deleted_v) Remap[i] = Remap[T];
+            }
+
+            if (nAlive == nMeshes) return;
+
+            // One pass over the facets
+            std::size_t nFacets = 0;
+            for (auto& F : Geom.m_Facet)
+            {
+                const int iNew = Remap[F.m_iMesh];
+                if (iNew == mesh_edits::deleted_v) continue;
+                F.m_iMesh = iNew;
+                Geom.m_Facet[nFacets++] = F;
+            }
+            Geom.m_Facet.resize(nFacets);
+
+            // One compaction of the meshes
+            for (int i = 0; i < nMeshes; ++i)
+            {
+                if (not Edits.isAlive(i) || Remap[i] == i) continue;
+                Geom.m_Mesh[Remap[i]] = std::move(Geom.m_Mesh[i]);
+            }
+            Geom.m_Mesh.resize(nAlive);
+        }
+
+        //--------------------------------------------------------------------------------------
+        // Instance detection. The importer bakes the node transforms into the vertices so every
+        // placement of a prop is its own raw mesh. Meshes with the same topology, materials and
+        // attributes are candidates, a candidate is a copy when a single affine transform (no
+        // mirroring) maps every position of the first mesh to its own and the normals agree.
+        // Copies are deleted and recorded as a transform of the first mesh.
+
+        struct raw_instance
+        {
+            int                         m_iMesh;        // Raw mesh index, the final mesh index once MergeMeshes is done
+            std::array<float, 12>       m_Transform;    // 3x4 row major
+        };
+
+        struct mesh_shape
+        {
+            std::vector<std::uint32_t>  m_Verts;        // Raw vertices in first touch order
+            std::vector<std::uint32_t>  m_Local;        // Facets as local vertex indices
+            std::vector<int>            m_Materials;    // One per facet
+            std::uint64_t               m_Hash = 0;
+        };
+
+        inline static constexpr std::size_t max_instance_classes_v = 8;     // Different shapes tried per hash before giving up
+
+        static std::optional<std::array<float, 12>> SolveInstanceTransform(const xraw3d::geom& Geom, const mesh_shape& From, const mesh_shape& To) noexcept
+        {
+            auto Pos  = [&](const mesh_shape& S, std::size_t i) { return Geom.m_Vertex[S.m_Verts[i]].m_Position; };
+            auto Len2 = [](const xmath::fvec3& V) { return xmath::fvec3::Dot(V, V); };
+
+            // Basis from the source: farthest point, then the widest triangle, then the biggest volume
+            const auto  n  = From.m_Verts.size();
+            const auto  P0 = Pos(From, 0);
+            std::size_t i1 = 0, i2 = 0, i3 = 0;
+            float       Best = 0;
+            for (std::size_t i = 1; i < n; ++i) if (float d = Len2(Pos(From, i) - P0); d > Best) { Best = d; i1 = i; }
+            if (Best == 0) return std::nullopt;
+
+            const auto E1 = Pos(From, i1) - P0;
+            Best = 0;
+            for (std::size_t i = 1; i < n; ++i) if (float d = Len2(xmath::fvec3::Cross(E1, Pos(From, i) - P0)); d > Best) { Best = d; i2 = i; }
+            if (Best == 0) return std::nullopt;
+
+            const auto E2 = Pos(From, i2) - P0;
+            const auto N  = xmath::fvec3::Cross(E1, E2);
+            Best = 0;
+            for (std::size_t i = 1; i < n; ++i) if (float d = std::abs(xmath::fvec3::Dot(N, Pos(From, i) - P0)); d > Best) { Best = d; i3 = i; }
+
+            // Flat meshes use the normal of the basis triangle (scaled so a similarity transform keeps it)
+            const float Size = std::sqrt(Len2(Pos(From, i1) - P0));
+            const bool  bFlat = Best <= 1e-6f * Size * N.Length();
+            const auto  Q0    = Pos(To, 0);
+            const auto  F1    = Pos(To, i1) - Q0;
+            const auto  F2    = Pos(To, i2) - Q0;
+            const auto  NQ    = xmath::fvec3::Cross(F1, F2);
+            const auto  E3    = bFlat ? N  / std::sqrt(N.Length())  : Pos(From, i3) - P0;
+            const auto  F3    = bFlat ? NQ / std::sqrt(std::max(NQ.Length(), 1e-30f)) : Pos(To, i3) - Q0;
+
+            // A = F * inverse(E), E and F with the edges as columns
+            const float Det = xmath::fvec3::Dot(E1, xmath::fvec3::Cross(E2, E3));
+            if (std::abs(Det) < 1e-30f) return std::nullopt;
+
+            const xmath::fvec3 InvRows[3] =
+            { xmath::fvec3::Cross(E2, E3) / Det
+            , xmath::fvec3::Cross(E3, E1) / Det
+            , xmath::fvec3::Cross(E1, E2) / Det
+            };
+
+            std::array<float, 12> T;
+            const xmath::fvec3 Cols[3] = { F1, F2, F3 };
+            auto Comp = [](const xmath::fvec3& V, int c) { return c == 0 ? V.m_X : c == 1 ? V.m_Y : V.m_Z; };
+            for (int r = 0; r < 3; ++r)
+                for (int c = 0; c < 3; ++c)
+                    T[r * 4 + c] = Comp(Cols[0], r) * Comp(InvRows[0], c) + Comp(Cols[1], r) * Comp(InvRows[1], c) + Comp(Cols[2], r) * Comp(InvRows[2], c);
+
+            auto Apply = [&](const xmath::fvec3& V, bool bPoint)
+            {
+                return xmath::fvec3
+                { T[0] * V.m_X + T[1] * V.m_Y + T[2]  * V.m_Z + (bPoint ? T[3]  : 0.0f)
+                , T[4] * V.m_X + T[5] * V.m_Y + T[6]  * V.m_Z + (bPoint ? T[7]  : 0.0f)
+                , T[8] * V.m_X + T[9] * V.m_Y + T[10] * V.m_Z + (bPoint ? T[11] : 0.0f)
+                };
+            };
+
+            const auto AP0 = Apply(P0, false);
+            T[3]  = Q0.m_X - AP0.m_X;
+            T[7]  = Q0.m_Y - AP0.m_Y;
+            T[11] = Q0.m_Z - AP0.m_Z;
+
+            // Mirrored copies would need the winding flipped
+            const xmath::fvec3 R0{ T[0], T[1], T[2] }, R1{ T[4], T[5], T[6] }, R2{ T[8], T[9], T[10] };
+            if (xmath::fvec3::Dot(R0, xmath::fvec3::Cross(R1, R2)) <= 0) return std::nullopt;
+
+            // Every position has to land on its copy, every normal has to follow the rotation
+            const float Tolerance = std::max(1e-5f, Size * 1e-4f);
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                if (Len2(Apply(Pos(From, i), true) - Pos(To, i)) > Tolerance * Tolerance) return std::nullopt;
+
+                const auto& A = Geom.m_Vertex[From.m_Verts[i]];
+                if (A.m_nNormals)
+                {
+                    // Normals transform with the cofactor matrix (inverse transpose up to a scale)
+                    const auto& N0 = A.m_BTN[0].m_Normal;
+                    const auto  C0 = xmath::fvec3::Cross(R1, R2), C1 = xmath::fvec3::Cross(R2, R0), C2 = xmath::fvec3::Cross(R0, R1);
+                    const auto  NT = C0 * N0.m_X + C1 * N0.m_Y + C2 * N0.m_Z;
+                    const auto& N1 = Geom.m_Vertex[To.m_Verts[i]].m_BTN[0].m_Normal;
+                    const float L  = NT.Length() * N1.Length();
+                    if (L > 0 && xmath::fvec3::Dot(NT, N1) < 0.999f * L) return std::nullopt;
+                }
+            }
+
+            return T;
+        }
+
+        //--------------------------------------------------------------------------------------
 
-                        initial.tri_ids.resize(num_tris);
-                        for (uint32_t i = 0; i < num_tris; ++i) initial.tri_ids[i] = i;
+        static void DetectInstances(const xraw3d::geom& Geom, mesh_edits& Edits, std::vector<raw_instance>& OutInstances)
+        {
+            const auto nMeshes = Geom.m_Mesh.size();
 
-                        size_t prev_num_clusters = OutClusters.size();
-                        RecurseClusterSplit(input_sm.m_Vertex, lod_indices, initial, 65534, max_extent, binormal_signs, OutClusters, OutAllStaticVerts, OutAllExtrasVerts, OutClusterData, OutAllIndices);
+            // Facets of every mesh in order (counting sort, stable)
+            std::vector<std::uint32_t> FacetOffset(nMeshes + 1, 0);
+            for (const auto& F : Geom.m_Facet) FacetOffset[F.m_iMesh + 1]++;
+            for (std::size_t i = 0; i < nMeshes; ++i) FacetOffset[i + 1] += FacetOffset[i];
 
-                        out_sm.m_nCluster    = static_cast<uint16_t>(OutClusters.size() - prev_num_clusters);
-                        current_cluster_idx += out_sm.m_nCluster;
-                        OutSubmeshes.push_back(out_sm);
-                    }
-                }
+            std::vector<std::uint32_t> MeshFacets(Geom.m_Facet.size());
+            {
+                std::vector<std::uint32_t> Cursor(FacetOffset.begin(), FacetOffset.end() - 1);
+                for (std::uint32_t f = 0; f < Geom.m_Facet.size(); ++f) MeshFacets[Cursor[Geom.m_Facet[f].m_iMesh]++] = f;
             }
-            result.m_nMeshes    = static_cast<std::uint16_t>(OutMeshes.size());
-            result.m_pMesh      = new geom::mesh[result.m_nMeshes];
-            std::ranges::copy(OutMeshes, result.m_pMesh);
-            result.m_nLODs      = static_cast<std::uint16_t>(OutLODs.size());
-            result.m_pLOD       = new geom::lod[result.m_nLODs];
-            std::ranges::copy(OutLODs, result.m_pLOD);
-            result.m_nSubMeshs  = static_cast<std::uint16_t>(OutSubmeshes.size());
-            result.m_pSubMesh   = new geom::submesh[result.m_nSubMeshs];
-            std::ranges::copy(OutSubmeshes, result.m_pSubMesh);
-            result.m_nClusters  = static_cast<std::uint16_t>(OutClusters.size());
-            result.m_pCluster   = new geom::cluster[result.m_nClusters];
-            std::ranges::copy(OutClusters, result.m_pCluster);
-            result.m_BBox       = OutGlobalBBox.to_fbbox();
-            result.m_nVertices  = static_cast<std::uint32_t>(OutAllStaticVerts.size());
-            result.m_nIndices   = static_cast<std::uint32_t>(OutAllIndices.size());
 
             //
-            // Set all the material instances
+            // Shape of every candidate, the hash leaves the positions out
             //
-            result.m_nDefaultMaterialInstances = static_cast<std::uint16_t>(m_RawGeom.m_MaterialInstance.size());
-            result.m_pDefaultMaterialInstances = new xrsc::material_instance_ref[result.m_nDefaultMaterialInstances];
+            std::vector<mesh_shape> Shapes(nMeshes);
+            ParallelFor(nMeshes, [&](std::size_t iMesh)
+            {
+                if (not Edits.isAlive(static_cast<int>(iMesh)) || Geom.m_Mesh[iMesh].m_nBones > 0) return;
+                if (FacetOffset[iMesh] == FacetOffset[iMesh + 1]) return;
 
-            // Set default values
-            std::memset(result.m_pDefaultMaterialInstances, 0, result.m_nDefaultMaterialInstances * sizeof(*result.m_pDefaultMaterialInstances));
+                auto&                                           S = Shapes[iMesh];
+                std::unordered_map<std::uint32_t, std::uint32_t> Local;
+                for (auto i = FacetOffset[iMesh]; i < FacetOffset[iMesh + 1]; ++i)
+                {
+                    const auto& F = Geom.m_Facet[MeshFacets[i]];
+                    S.m_Materials.push_back(F.m_iMaterialInstance);
+                    for (int j = 0; j < 3; ++j)
+                    {
+                        const auto [It, bNew] = Local.try_emplace(static_cast<std::uint32_t>(F.m_iVertex[j]), static_cast<std::uint32_t>(S.m_Verts.size()));
+                        if (bNew) S.m_Verts.push_back(It->first);
+                        S.m_Local.push_back(It->second);
+                    }
+                }
 
-            // Set all the materials that we know about
-            for (auto& E : m_RawGeom.m_MaterialInstance)
-            {
-                const auto Index = static_cast<int>(&E - m_RawGeom.m_MaterialInstance.data());
-                if (int iMaterial = m_Descriptor.findMaterial(E.m_Name); iMaterial != -1)
-                    result.m_pDefaultMaterialInstances[Index] = m_Descriptor.m_MaterialInstRefList[iMaterial];
-            }
+                std::uint64_t Hash = HashBytes(S.m_Local.data(), S.m_Local.size() * sizeof(std::uint32_t));
+                Hash = HashBytes(S.m_Materials.data(), S.m_Materials.size() * sizeof(int), Hash);
+                for (auto v : S.m_Verts)
+                {
+                    const auto& V = Geom.m_Vertex[v];
+                    Hash = HashBytes(&V.m_nUVs,     sizeof(V.m_nUVs),     Hash);
+                    Hash = HashBytes(&V.m_nColors,  sizeof(V.m_nColors),  Hash);
+                    Hash = HashBytes(&V.m_nNormals, sizeof(V.m_nNormals), Hash);
+                    for (int j = 0; j < V.m_nUVs; ++j) Hash = HashBytes(&V.m_UV[j], sizeof(float) * 2, Hash);
+                    if (V.m_nColors) Hash = HashBytes(&V.m_Color[0], sizeof(V.m_Color[0]), Hash);
+                }
+                S.m_Hash = Hash;
+            });
 
             //
-            // Build the final data
+            // Group by hash and match against the first mesh of every class
             //
-            // Compute aligned sizes for GPU data
-            auto align = [](std::size_t offset, std::size_t alignment) constexpr -> std::size_t
+            std::unordered_map<std::uint64_t, std::vector<int>> Classes;
+            auto SameAttributes = [&](const mesh_shape& A, const mesh_shape& B)
             {
-                return (offset + alignment - 1) & ~(alignment - 1);
+                if (A.m_Local != B.m_Local || A.m_Materials != B.m_Materials) return false;
+                for (std::size_t i = 0; i < A.m_Verts.size(); ++i)
+                {
+                    const auto& VA = Geom.m_Vertex[A.m_Verts[i]];
+                    const auto& VB = Geom.m_Vertex[B.m_Verts[i]];
+                    if (VA.m_nUVs != VB.m_nUVs || VA.m_nColors != VB.m_nColors || VA.m_nNormals != VB.m_nNormals) return false;
+                    for (int j = 0; j < VA.m_nUVs; ++j) if (VA.m_UV[j].m_X != VB.m_UV[j].m_X || VA.m_UV[j].m_Y != VB.m_UV[j].m_Y) return false;
+                    if (VA.m_nColors && std::memcmp(&VA.m_Color[0], &VB.m_Color[0], sizeof(VA.m_Color[0]))) return false;
+                }
+                return true;
             };
 
-            constexpr std::size_t   vulkan_align    = 64; // Min for Vulkan buffers/UBO
-            const std::size_t       VertexSize      = OutAllStaticVerts.size() * sizeof(geom::vertex);
-            const std::size_t       ExtrasSize      = OutAllExtrasVerts.size() * sizeof(geom::vertex_extras);
-            const std::size_t       IndicesSize     = OutAllIndices.size()     * sizeof(std::uint16_t);
-            const std::size_t       ClusterDataSize = OutClusterData.size()    * sizeof(geom::cluster_data);
-
-            std::size_t             current_offset  = 0;
-
-            result.m_VertexOffset           = current_offset; current_offset = align(current_offset + VertexSize,       vulkan_align);
-            result.m_VertexExtrasOffset     = current_offset; current_offset = align(current_offset + ExtrasSize,       vulkan_align);
-            result.m_IndicesOffset          = current_offset; current_offset = align(current_offset + IndicesSize,      vulkan_align);
-            result.m_ClusterDataOffset      = current_offset; current_offset = align(current_offset + ClusterDataSize,  vulkan_align);
-            result.m_DataSize               = current_offset;
-            result.m_pData                  = new char[result.m_DataSize];
+            for (int iMesh = 0; iMesh < static_cast<int>(nMeshes); ++iMesh)
+            {
+                const auto& S = Shapes[iMesh];
+                if (S.m_Verts.empty()) continue;
 
-            // Copy data into m_pData
-            std::memcpy(result.m_pData + result.m_VertexOffset,         OutAllStaticVerts.data(), VertexSize);
-            std::memcpy(result.m_pData + result.m_VertexExtrasOffset,   OutAllExtrasVerts.data(), ExtrasSize);
-            std::memcpy(result.m_pData + result.m_ClusterDataOffset,    OutClusterData.data(),    ClusterDataSize);
+                auto& Reps = Classes[S.m_Hash];
+                bool  bInstance = false;
+                for (int iRep : Reps)
+                {
+                    if (not SameAttributes(Shapes[iRep], S)) continue;
+                    if (auto T = SolveInstanceTransform(Geom, Shapes[iRep], S); T)
+                    {
+                        OutInstances.push_back({ iRep, *T });
+                        Edits.m_Target[iMesh] = mesh_edits::deleted_v;
+                        bInstance = true;
+                        break;
+                    }
+                }
 
-            // Copy the indices
-            auto pIndex = reinterpret_cast<std::uint16_t*>(result.m_pData + result.m_IndicesOffset);
-            for (size_t i = 0; i < OutAllIndices.size(); ++i)
-            {
-                assert(OutAllIndices[i] < 0xffff);
-                pIndex[i] = static_cast<std::uint16_t>(OutAllIndices[i]);
+                if (not bInstance && Reps.size() < max_instance_classes_v) Reps.push_back(iMesh);
             }
-
-            // Make sure that at least we have one cluster
-            assert(result.m_nClusters >= 1);
         }
 
         //--------------------------------------------------------------------------------------
 
-        static void MergeMeshes(std::unordered_map<std::string, xgeom_static::mesh_details*>& OutHashMap, xraw3d::geom& Geom, const xgeom_static::descriptor& Descriptor, const xgeom_static::details& Details) noexcept
+        static void MergeMeshes(std::unordered_map<std::string, xgeom_static::mesh_details*>& OutHashMap, xraw3d::geom& Geom, mesh_edits& Edits, const xgeom_static::descriptor& Descriptor, std::vector<raw_instance>& OutInstances)
         {
+            if (Descriptor.m_bMergeAllMeshes && Descriptor.m_bDetectInstances)
+            {
+                DetectInstances(Geom, Edits, OutInstances);
+
+                // Meshes with instances stay on their own, the rest collapses into one
+                std::vector<bool> bHasInstances(Geom.m_Mesh.size(), false);
+                for (const auto& I : OutInstances) bHasInstances[I.m_iMesh] = true;
+
+                std::string newName  = Descriptor.m_AllMeshesDetails.m_Name;
+                int         Survivor = mesh_edits::deleted_v;
+                for (int i = 0; i < static_cast<int>(Geom.m_Mesh.size()); ++i)
+                {
+                    if (not Edits.isAlive(i)) continue;
+
+                    if (bHasInstances[i])
+                    {
+                        OutHashMap[Geom.m_Mesh[i].m_Name] = const_cast<xgeom_static::mesh_details*>(&Descriptor.m_AllMeshesDetails);
+                    }
+                    else if (Survivor == mesh_edits::deleted_v)
+                    {
+                        Survivor = i;
+                        Geom.m_Mesh[i].m_Name = newName;
+                    }
+                    else
+                    {
+                        Geom.m_Mesh[Survivor].m_nBones = std::max(Geom.m_Mesh[Survivor].m_nBones, Geom.m_Mesh[i].m_nBones);
+                        Edits.m_Target[i] = Survivor;
+                    }
+                }
+                OutHashMap[newName] = const_cast<xgeom_static::mesh_details*>(&Descriptor.m_AllMeshesDetails);
+
+                // Survivors keep their relative order
+                std::vector<int> FinalIndex(Geom.m_Mesh.size(), mesh_edits::deleted_v);
+                for (int i = 0, n = 0; i < static_cast<int>(Geom.m_Mesh.size()); ++i)
+                    if (Edits.isAlive(i)) FinalIndex[i] = n++;
+                for (auto& I : OutInstances) I.m_iMesh = FinalIndex[I.m_iMesh];
+
+                ApplyMeshEdits(Geom, Edits);
+                Geom.SortFacetsByMeshMaterialBone();
+                return;
+            }
+
             if (Descriptor.m_bMergeAllMeshes)
             {
+                ApplyMeshEdits(Geom, Edits);
+
                 std::string newName = Descriptor.m_AllMeshesDetails.m_Name;
                 Geom.CollapseMeshes(newName);
                 if (!Geom.m_Mesh.empty())
@@ -863,104 +4145,116 @@ void ConvertToCompilerMesh(void)
                     Geom.m_Mesh[0].m_Name = newName;
                 }
                 OutHashMap[newName] = const_cast<xgeom_static::mesh_details*>(&Descriptor.m_AllMeshesDetails);
+                return;
             }
-            else
+
+            //
+            // Node path -> merge group, the first group that lists a node wins
+            //
+            std::unordered_map<std::string_view, int> NodeToGroup;
+            for (int g = 0; g < static_cast<int>(Descriptor.m_MergeGroupList.size()); ++g)
+                for (const auto& np : Descriptor.m_MergeGroupList[g].m_NodePathList)
+                    NodeToGroup.try_emplace(std::string_view(np), g);
+
+            //
+            // Assign each mesh to a group by walking the node prefixes of its path
+            //
+            std::vector<int> Survivor(Descriptor.m_MergeGroupList.size(), mesh_edits::deleted_v);
+            if (not NodeToGroup.empty())
             {
-                for (const auto& group : Descriptor.m_MergeGroupList)
+                for (int i = 0; i < static_cast<int>(Geom.m_Mesh.size()); ++i)
                 {
-                    std::string newName = group.m_MeshDetails.m_Name;
+                    if (not Edits.isAlive(i)) continue;
 
-                    std::unordered_set<int> olds;
-                    for (const auto& np : group.m_NodePathList)
+                    const std::string_view Path  = Geom.m_Mesh[i].m_ScenePath;
+                    int                    Group = mesh_edits::deleted_v;
+                    for (auto iSlash = Path.find('/'); iSlash != std::string_view::npos; iSlash = Path.find('/', iSlash + 1))
                     {
-                        std::string prefix = np + "/";
-                        for (int i = 0; i < static_cast<int>(Geom.m_Mesh.size()); ++i)
-                        {
-                            if (Geom.m_Mesh[i].m_ScenePath.starts_with(prefix))
-                                olds.insert(i);
-                        }
+                        if (auto It = NodeToGroup.find(Path.substr(0, iSlash)); It != NodeToGroup.end() && (Group == mesh_edits::deleted_v || It->second < Group))
+                            Group = It->second;
                     }
+                    if (Group == mesh_edits::deleted_v) continue;
 
-                    if (olds.empty()) continue;
-
-                    int survivor = *std::min_element(olds.begin(), olds.end());
-
-                    int maxBones = 0;
-                    for (int i : olds)
-                        maxBones = std::max(maxBones, Geom.m_Mesh[i].m_nBones);
-                    Geom.m_Mesh[survivor].m_nBones = maxBones;
-
-                    Geom.m_Mesh[survivor].m_Name = newName;
-
-                    for (int i : olds)
+                    // Meshes are visited in order so the first one is the lowest index
+                    auto& S = Survivor[Group];
+                    if (S == mesh_edits::deleted_v)
                     {
-                        if (i == survivor) continue;
-                        for (auto& f : Geom.m_Facet)
-                            if (f.m_iMesh == i)
-                                f.m_iMesh = survivor;
+                        S = i;
+                        Geom.m_Mesh[S].m_Name = Descriptor.m_MergeGroupList[Group].m_MeshDetails.m_Name;
                     }
+                    else
+                    {
+                        Geom.m_Mesh[S].m_nBones = std::max(Geom.m_Mesh[S].m_nBones, Geom.m_Mesh[i].m_nBones);
+                        Edits.m_Target[i]       = S;
+                    }
+                }
 
-                    // Delete non-survivors for this group
-                    std::vector<int> groupDelete;
-                    for (int i : olds)
-                        if (i != survivor)
-                            groupDelete.push_back(i);
-
-                    std::sort(groupDelete.rbegin(), groupDelete.rend());
-
-                    for (int i : groupDelete)
-                        Geom.DeleteMesh(i);
-
-                    OutHashMap[newName] = const_cast<xgeom_static::mesh_details*>(&group.m_MeshDetails);
+                for (std::size_t g = 0; g < Survivor.size(); ++g)
+                {
+                    if (Survivor[g] == mesh_edits::deleted_v) continue;
+                    const auto& Group = Descriptor.m_MergeGroupList[g];
+                    OutHashMap[Group.m_MeshDetails.m_Name] = const_cast<xgeom_static::mesh_details*>(&Group.m_MeshDetails);
                 }
+            }
+
+            //
+            // Ungrouped meshes only get renamed, the path map holds the scene path of every
+            // mesh so a miss means the mesh is not there
+            //
+            if (not Descriptor.m_UngroupMeshList.empty())
+            {
+                std::unordered_map<std::string_view, int> PathToMesh;
+                PathToMesh.reserve(Geom.m_Mesh.size());
+                for (int i = 0; i < static_cast<int>(Geom.m_Mesh.size()); ++i)
+                    PathToMesh.try_emplace(std::string_view(Geom.m_Mesh[i].m_ScenePath), i);
 
                 for (const auto& um : Descriptor.m_UngroupMeshList)
                 {
                     std::string fullName = um.m_NodePath + "/" + um.m_MeshName;
-                    int idx = Geom.findMeshByPath(fullName);
-                    if (idx != -1)
+                    auto        It       = PathToMesh.find(fullName);
+                    if (It == PathToMesh.end()) continue;
+
+                    if (const int idx = It->second; Edits.isAlive(idx))
                     {
                         std::string newName = um.m_MeshDetails.m_Name;
                         Geom.m_Mesh[idx].m_Name = newName;
                         OutHashMap[newName] = const_cast<xgeom_static::mesh_details*>(&um.m_MeshDetails);
                     }
                 }
-
-                Geom.SortFacetsByMeshMaterialBone();
             }
+
+            ApplyMeshEdits(Geom, Edits);
+            Geom.SortFacetsByMeshMaterialBone();
         }
 
         //--------------------------------------------------------------------------------------
 
         void MergeMeshes()
         {
+            mesh_edits Edits(m_RawGeom.m_Mesh.size());
+
             //
-            // Delete all the unwanted meshes
+            // Mark all the unwanted meshes. The details were built from the raw geom before
+            // any edit so their mesh indices are the raw mesh indices.
             //
             {
-                std::vector<std::string> Path;
+                std::string Path;
                 std::function<void(const xgeom_static::details::node&, bool)> Recursive = [&](const xgeom_static::details::node& Node, bool bDelete )
                 {
-                    if (Path.empty()) Path.push_back(Node.m_Name);
-                    else              Path.push_back( std::format("{}/{}", Path.back(), Node.m_Name ));
+                    const auto ParentLength = Path.size();
+                    if (Path.empty()) Path  = Node.m_Name;
+                    else            { Path += '/'; Path += Node.m_Name; }
 
                     if ( bDelete == false )
                     {
-                        if (m_Descriptor.isNodeInDeleteList(Path.back())) 
+                        if (m_Descriptor.isNodeInDeleteList(Path)) 
                             bDelete = true;
                     }
 
                     for (auto idx : Node.m_MeshList)
                     {
-                        if (bDelete || m_Descriptor.isMeshInDeleteList(Path.back(), m_Details.m_MeshList[idx].m_Name))
-                        {
-                            std::string PathStr = std::format("{}/{}", Path.back(), m_Details.m_MeshList[idx].m_Name);
-                            int         iRawMesh = m_RawGeom.findMeshByPath(PathStr);
-                            if (iRawMesh != -1)
-                            {
-                                m_RawGeom.DeleteMesh(iRawMesh);
-                            }
-                        }
+                        if (static_cast<std::size_t>(idx) < Edits.m_Target.size() && (bDelete || m_Descriptor.isMeshInDeleteList(Path, m_Details.m_MeshList[idx].m_Name)))
+                            Edits.m_Target[idx] = mesh_edits::deleted_v;
                     }
 
                     //
@@ -971,16 +4265,22 @@ void ConvertToCompilerMesh(void)
                         Recursive(n, bDelete);
                     }
 
-                    Path.pop_back();
+                    Path.resize(ParentLength);
                 };
 
                 Recursive(m_Details.m_RootNode, false);
             }
 
             //
-            // Now we can actually merge the meshes
+            // Now we can actually merge the meshes, both edits are applied in one go
             //
-            MergeMeshes(m_NameToDetail, m_RawGeom, m_Descriptor, m_Details);
+            MergeMeshes(m_NameToDetail, m_RawGeom, Edits, m_Descriptor, m_Instances);
+
+            if (not m_Instances.empty())
+            {
+                LogMessage(xresource_pipeline::msg_type::INFO, std::format("Instances: {} repeated meshes replaced by transforms", m_Instances.size()));
+                LogMessage(xresource_pipeline::msg_type::WARNING, "The asset has instances, renderers that do not draw geom::ForEachMeshPlacement only show the first copy of every repeated mesh");
+            }
         }
 
         //--------------------------------------------------------------------------------------
@@ -1000,16 +4300,8 @@ void ConvertToCompilerMesh(void)
                 }
 
                 //
-                // Merge meshes
-                //
-                {
-                    displayProgressBar("Merging Meshes", 1);
-                    MergeMeshes();
-                    displayProgressBar("Merging Meshes", 0);
-                }
-
-                //
-                // Pre-Transform the verts
+                // Pre-Transform the verts, before the merge so the instances are detected (and
+                // their transforms recorded) in the final space
                 //
                 if (   m_Descriptor.m_PreTranslation.m_Scale       != xmath::fvec3::fromOne() 
                     || m_Descriptor.m_PreTranslation.m_Translation != xmath::fvec3::fromZero()
@@ -1036,6 +4328,16 @@ void ConvertToCompilerMesh(void)
                     displayProgressBar("PreTranslatingMeshes", 1);
                 }
 
+                //
+                // Merge meshes
+                //
+                {
+                    profiler::scope Scope("MergeMeshes");
+                    displayProgressBar("Merging Meshes", 0);
+                    MergeMeshes();
+                    displayProgressBar("Merging Meshes", 1);
+                }
+
                 //
                 // Normalize Mesh
                 //
@@ -1055,10 +4357,21 @@ void ConvertToCompilerMesh(void)
                 // Clean the mesh
                 //
                 {
-                    displayProgressBar("Cleaning up Geom", 1);
-                    m_RawGeom.ComputeTangentsAndBinormalsMikk();
-                    m_RawGeom.CleanMesh();
-                    m_RawGeom.SortFacetsByMeshMaterialBone();
+                    displayProgressBar("Cleaning up Geom", 0);
+                    {
+                        profiler::scope Scope("ComputeTangents");
+                        m_RawGeom.ComputeTangentsAndBinormalsMikk();
+                    }
+                    displayProgressBar("Cleaning up Geom", 0.4f);
+                    {
+                        profiler::scope Scope("CleanMesh");
+                        m_RawGeom.CleanMesh();
+                    }
+                    displayProgressBar("Cleaning up Geom", 0.8f);
+                    {
+                        profiler::scope Scope("SortFacets");
+                        m_RawGeom.SortFacetsByMeshMaterialBone();
+                    }
                     displayProgressBar("Cleaning up Geom", 1);
                 }
 
@@ -1067,10 +4380,32 @@ void ConvertToCompilerMesh(void)
                 //
                 m_FinalGeom.Initialize();
 
-                displayProgressBar("Generating LODs", 1);
-                ConvertToCompilerMesh();
-                GenenateLODs();
                 displayProgressBar("Generating LODs", 0);
+                {
+                    profiler::scope Scope("ConvertToCompilerMesh");
+                    ConvertToCompilerMesh();
+                }
+
+                // In the streaming mode the raw vertices and facets are released as soon as
+                // the compiler meshes own a copy, nothing after this point reads them (the
+                // material instances are still needed). The import itself is not out-of-core.
+                if (m_Descriptor.m_MemoryBudgetMB > 0)
+                {
+                    m_RawGeom.m_Vertex = {};
+                    m_RawGeom.m_Facet  = {};
+                }
+
+                if (m_Descriptor.m_ClusterSettings.m_bWeldVertices)
+                {
+                    profiler::scope Scope("WeldCompilerMesh");
+                    WeldCompilerMesh();
+                }
+                displayProgressBar("Generating LODs", 0.5f);
+                {
+                    profiler::scope Scope("GenenateLODs");
+                    GenenateLODs();
+                }
+                displayProgressBar("Generating LODs", 1);
 
                 //
                 // Generate final mesh
@@ -1078,15 +4413,31 @@ void ConvertToCompilerMesh(void)
                 displayProgressBar("Generating Final Mesh", 0);
 
                 // mm accuracy
-                ConvertToGeom(0.001f);
+                {
+                    profiler::scope Scope("ConvertToGeom");
+                    ConvertToGeom(0.001f);
+                }
                 
                 displayProgressBar("Generating Final Mesh", 1);
+
+                if (m_Descriptor.m_bEncodePayload)
+                {
+                    profiler::scope Scope("EncodePayload");
+                    displayProgressBar("Encoding Payload", 0);
+                    EncodePayload();
+                    displayProgressBar("Encoding Payload", 1);
+                }
             }
-            catch (std::runtime_error Error )
+            catch (const std::exception& Error)
             {
                 LogMessage(xresource_pipeline::msg_type::ERROR, std::format("{}", Error.what()));
                 return xerr::create_f<state, "Exception thrown">();
             }
+            catch (...)
+            {
+                LogMessage(xresource_pipeline::msg_type::ERROR, "Unknown exception thrown");
+                return xerr::create_f<state, "Exception thrown">();
+            }
 
             return {};
         }
@@ -1186,12 +4537,47 @@ void ConvertToCompilerMesh(void)
         //--------------------------------------------------------------------------------------
 
         xerr onCompile(void) noexcept override
+        {
+            //
+            // Every stage is timed, the trace is written even when the compile fails so
+            // the build farm can see where it stopped
+            //
+            profiler::Reset();
+
+            // Nothing may escape from here, in batch mode that would take down every other job
+            xerr Err;
+            try
+            {
+                profiler::scope Scope("Total");
+                Err = CompileStages();
+            }
+            catch (const std::exception& Error)
+            {
+                LogMessage(xresource_pipeline::msg_type::ERROR, std::format("{}", Error.what()));
+                Err = xerr::create_f<state, "Exception thrown">();
+            }
+            catch (...)
+            {
+                LogMessage(xresource_pipeline::msg_type::ERROR, "Unknown exception thrown");
+                Err = xerr::create_f<state, "Exception thrown">();
+            }
+
+            if (not profiler::WriteChromeTrace(std::format(L"{}\\CompileTrace.json", m_ResourceLogPath)))
+                LogMessage(xresource_pipeline::msg_type::INFO, "Unable to write CompileTrace.json");
+
+            return Err;
+        }
+
+        //--------------------------------------------------------------------------------------
+
+        xerr CompileStages(void)
         {
             //
             // Read the descriptor file...
             //
             displayProgressBar("Loading Descriptor", 0);
             {
+                profiler::scope                 Scope("LoadDescriptor");
                 xproperty::settings::context    Context{};
                 auto                            DescriptorFileName = std::format(L"{}/{}/Descriptor.txt", m_ProjectPaths.m_Project, m_InputSrcDescriptorPath);
 
@@ -1219,19 +4605,29 @@ void ConvertToCompilerMesh(void)
             // Load the source data
             //
             displayProgressBar("Loading Mesh", 0);
-            if ( auto Err = LoadRaw(std::format(L"{}/{}", m_ProjectPaths.m_Project, m_Descriptor.m_ImportAsset)); Err )
-                return Err;
+            {
+                profiler::scope Scope("Import");
+                if ( auto Err = LoadRaw(std::format(L"{}/{}", m_ProjectPaths.m_Project, m_Descriptor.m_ImportAsset)); Err )
+                    return Err;
+            }
             displayProgressBar("Loading Mesh", 1);
 
             //
             // Fill the detail structure
             //
-            ComputeDetailStructure();
+            {
+                profiler::scope Scope("ComputeDetailStructure");
+                ComputeDetailStructure();
+            }
 
             //
             // OK Time to compile
             //
-            Compile();
+            {
+                profiler::scope Scope("Compile");
+                if (auto Err = Compile(); Err)
+                    return Err;
+            }
 
             //
             // Serialize the details structure
@@ -1247,16 +4643,87 @@ void ConvertToCompilerMesh(void)
             }
 
             //
-            // Export
+            // Export. The geom is the same for every target so it is only serialized once per
+            // distinct encoding (in parallel), the rest of the targets get a copy of the file.
             //
-            int Count = 0;
-            for (auto& T : m_Target)
+            displayProgressBar("Serializing", 0);
             {
-                displayProgressBar("Serializing", Count++ / (float)m_Target.size());
+                profiler::scope Scope("Serialize");
+
+                struct variant
+                {
+                    xserializer::compression_level  m_Compression;
+                    std::vector<std::wstring_view>  m_Paths;
+                };
+
+                std::vector<variant> Variants;
+                for (auto& T : m_Target)
+                {
+                    if (not T.m_bValid) continue;
+
+                    // Every target uses the same encoding today, this is where a per platform one would go
+                    const auto Compression = getCompressionLevel();
+                    auto       It          = std::ranges::find_if(Variants, [&](const variant& V) { return V.m_Compression == Compression; });
+                    if (It == Variants.end()) It = Variants.insert(Variants.end(), variant{ Compression });
+                    It->m_Paths.push_back(T.m_DataPath);
+                }
+
+                // With a shared payload the targets only get the header, the payload goes to
+                // the content store of every target (once, the first compile that needs it)
+                geom Header = m_FinalGeom;
+                geom Payload;
+                if (m_Descriptor.m_bSharedPayload)
+                {
+                    SplitPayload(m_FinalGeom, Header, Payload);
+
+                    std::vector<std::wstring> PayloadPaths;
+                    for (const auto& V : Variants)
+                        for (const auto& P : V.m_Paths)
+                        {
+                            auto Path = geom::getPayloadPath(std::filesystem::path(P), Header.m_PayloadHash).wstring();
+                            if (std::ranges::find(PayloadPaths, Path) == PayloadPaths.end()) PayloadPaths.push_back(std::move(Path));
+                        }
+
+                    for (const auto& Path : PayloadPaths)
+                    {
+                        if (auto Err = WritePayload(Path, Payload, getCompressionLevel()); Err)
+                        {
+                            LogMessage(xresource_pipeline::msg_type::ERROR, std::format("Failed to write the shared payload ({})", Err.getMessage()));
+                            return xerr::create_f<state, "Failed to write the shared payload">();
+                        }
+                    }
+                }
+
+                std::vector<std::string> Errors(Variants.size());
+                ParallelFor(Variants.size(), [&](std::size_t i)
+                {
+                    if (auto Err = Serialize(Variants[i].m_Paths[0], Header, Variants[i].m_Compression); Err)
+                        Errors[i] = Err.getMessage();
+                });
+
+                for (auto& E : Errors)
+                {
+                    if (E.empty()) continue;
+                    LogMessage(xresource_pipeline::msg_type::ERROR, std::move(E));
+                    return xerr::create_f<state, "Failed to serialize the geom">();
+                }
+
+                // Fan out the files to the rest of the targets
+                std::vector<std::pair<std::wstring_view, std::wstring_view>> Copies;
+                for (const auto& V : Variants)
+                    for (std::size_t p = 1; p < V.m_Paths.size(); ++p) Copies.emplace_back(V.m_Paths[0], V.m_Paths[p]);
+
+                std::vector<std::error_code> CopyErrors(Copies.size());
+                ParallelFor(Copies.size(), [&](std::size_t i)
+                {
+                    std::filesystem::copy_file(std::filesystem::path(Copies[i].first), std::filesystem::path(Copies[i].second), std::filesystem::copy_options::overwrite_existing, CopyErrors[i]);
+                });
 
-                if (T.m_bValid)
+                for (auto& Ec : CopyErrors)
                 {
-                    Serialize(T.m_DataPath);
+                    if (not Ec) continue;
+                    LogMessage(xresource_pipeline::msg_type::ERROR, std::format("Failed to copy the compiled geom to a target ({})", Ec.message()));
+                    return xerr::create_f<state, "Failed to write one of the targets">();
                 }
             }
             displayProgressBar("Serializing", 1);
@@ -1265,17 +4732,127 @@ void ConvertToCompilerMesh(void)
 
         //--------------------------------------------------------------------------------------
 
-        void Serialize(const std::wstring_view FilePath)
+        xserializer::compression_level getCompressionLevel(void) const noexcept
+        {
+            return m_OptimizationType == optimization_type::O0 ? xserializer::compression_level::FAST : m_OptimizationType == optimization_type::O1 ? xserializer::compression_level::MEDIUM : xserializer::compression_level::HIGH;
+        }
+
+        //--------------------------------------------------------------------------------------
+
+        xerr Serialize(const std::wstring_view FilePath, geom& Geom, xserializer::compression_level Compression)
         {
             xserializer::stream Serializer;
-            if( auto Err = Serializer.Save
-                ( FilePath
-                , m_FinalGeom
-                , m_OptimizationType == optimization_type::O0 ? xserializer::compression_level::FAST : m_OptimizationType == optimization_type::O1 ? xserializer::compression_level::MEDIUM : xserializer::compression_level::HIGH
-                ); Err )
+            return Serializer.Save(FilePath, Geom, Compression);
+        }
+
+        //--------------------------------------------------------------------------------------
+        // Content hash of everything that goes into the shared payload
+
+        static std::uint64_t HashPayload(const geom& Geom) noexcept
+        {
+            std::uint64_t Hash = HashBytes(&geom::xserializer_version_v, sizeof(geom::xserializer_version_v));
+            auto Value = [&](const auto& V) { Hash = HashBytes(&V, sizeof(V), Hash); };
+
+            Value(Geom.m_Flags);
+            Value(Geom.m_DataSize);
+            Value(Geom.m_DecodedDataSize);
+            Value(Geom.m_VertexOffset);
+            Value(Geom.m_VertexExtrasOffset);
+            Value(Geom.m_IndicesOffset);
+            Value(Geom.m_ClusterDataOffset);
+            Value(Geom.m_nVertices);
+            Value(Geom.m_nIndices);
+            Hash = HashBytes(Geom.m_pData, Geom.m_DataSize, Hash);
+
+            // Field by field, the xmath types may carry padding
+            Value(Geom.m_nClusters);
+            for (const auto& C : Geom.getClusters())
+            {
+                Value(C.m_BBox.m_Min.m_X); Value(C.m_BBox.m_Min.m_Y); Value(C.m_BBox.m_Min.m_Z);
+                Value(C.m_BBox.m_Max.m_X); Value(C.m_BBox.m_Max.m_Y); Value(C.m_BBox.m_Max.m_Z);
+                Value(C.m_BoundingSphere);
+                Value(C.m_ConeAxisCutoff);
+                Value(C.m_ConeApex);
+                Value(C.m_iIndex);
+                Value(C.m_nIndices);
+                Value(C.m_iVertex);
+                Value(C.m_nVertices);
+            }
+
+            Value(Geom.m_nClusterLODs);
+            Hash = HashBytes(Geom.m_pClusterLOD, Geom.m_nClusterLODs * sizeof(geom::cluster_lod), Hash);
+
+            return Hash;
+        }
+
+        //--------------------------------------------------------------------------------------
+        // Splits the final geom in the header that each asset keeps (meshes, LODs, submeshes,
+        // instances and materials) and the shareable payload (clusters, cluster LODs and GPU data). Both are
+        // shallow copies of Geom, they must not be killed.
+
+        static void SplitPayload(const geom& Geom, geom& Header, geom& Payload) noexcept
+        {
+            Payload = Geom;
+            Payload.m_nMeshes                   = 0;
+            Payload.m_pMesh                     = nullptr;
+            Payload.m_nLODs                     = 0;
+            Payload.m_pLOD                      = nullptr;
+            Payload.m_nSubMeshs                 = 0;
+            Payload.m_pSubMesh                  = nullptr;
+            Payload.m_nInstances                = 0;
+            Payload.m_pInstance                 = nullptr;
+            Payload.m_nDefaultMaterialInstances = 0;
+            Payload.m_pDefaultMaterialInstances = nullptr;
+
+            Header = Geom;
+            Header.m_nClusters                  = 0;
+            Header.m_pCluster                   = nullptr;
+            Header.m_nClusterLODs               = 0;
+            Header.m_pClusterLOD                = nullptr;
+            Header.m_DataSize                   = 0;
+            Header.m_pData                      = nullptr;
+            Header.m_DecodedDataSize            = 0;
+            Header.m_VertexOffset               = 0;
+            Header.m_VertexExtrasOffset         = 0;
+            Header.m_IndicesOffset              = 0;
+            Header.m_ClusterDataOffset          = 0;
+            Header.m_nVertices                  = 0;
+            Header.m_nIndices                   = 0;
+            Header.m_PayloadHash                = HashPayload(Geom);
+            Payload.m_PayloadHash               = Header.m_PayloadHash;
+            Header.m_Flags                      = (Geom.m_Flags & geom::flags_index32_v) | geom::flags_shared_payload_v;
+        }
+
+        //--------------------------------------------------------------------------------------
+        // Payloads are content addressed so an existing file is already the right one. Other
+        // compiles (batch mode, other processes) may write the same payload at the same time,
+        // each one writes its own temporary file and renames it into place.
+
+        xerr WritePayload(const std::wstring& Path, geom& Payload, xserializer::compression_level Compression)
+        {
+            std::error_code Ec;
+            if (std::filesystem::exists(std::filesystem::path(Path), Ec))
             {
-                throw(std::runtime_error(std::string(Err.getMessage())));
+                LogMessage(xresource_pipeline::msg_type::INFO, std::format("Shared payload {:016x} reused", Payload.m_PayloadHash));
+                return {};
             }
+
+            std::filesystem::create_directories(std::filesystem::path(Path).parent_path(), Ec);
+
+            const auto TempPath = std::format(L"{}.{:x}.tmp", Path, std::hash<std::thread::id>{}(std::this_thread::get_id()));
+            if (auto Err = Serialize(TempPath, Payload, Compression); Err)
+                return Err;
+
+            std::filesystem::rename(std::filesystem::path(TempPath), std::filesystem::path(Path), Ec);
+            if (Ec)
+            {
+                std::filesystem::remove(std::filesystem::path(TempPath), Ec);
+                if (not std::filesystem::exists(std::filesystem::path(Path), Ec))
+                    return xerr::create_f<state, "Unable to move the shared payload into the store">();
+            }
+
+            LogMessage(xresource_pipeline::msg_type::INFO, std::format("Shared payload {:016x} stored", Payload.m_PayloadHash));
+            return {};
         }
 
         meshopt_VertexCacheStatistics   m_VertCacheAMDStats;
@@ -1289,6 +4866,7 @@ void ConvertToCompilerMesh(void)
         xgeom_static::descriptor        m_Descriptor;
 
         xgeom_static::geom              m_FinalGeom;
+        std::vector<raw_instance>       m_Instances;
         std::vector<mesh>               m_CompilerMesh;
         xraw3d::geom                    m_RawGeom;
         xraw3d::assimp_v3::node         m_RootNode;
@@ -0,0 +1,253 @@
+#include "xgeom_static_compiler_profiler.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+    #define NOMINMAX
+    #include <windows.h>
+    #include <psapi.h>
+#else
+    #include <sys/resource.h>
+#endif
+
+//------------------------------------------------------------------------------------
+// Allocation counter. Replacing the global operator new is the only way to see every
+// allocation (std containers, the importer, meshoptimizer through its allocator, ...).
+// The over-aligned versions (SIMD math types) are replaced as well so they are counted.
+//------------------------------------------------------------------------------------
+
+namespace
+{
+    std::atomic<std::uint64_t> s_AllocationCount{ 0 };
+
+    // Over-aligned blocks have to be released with the matching function of the platform
+    void* AlignedAlloc(std::size_t Size, std::align_val_t Alignment) noexcept
+    {
+        const auto Align = static_cast<std::size_t>(Alignment);
+        if (Size == 0) Size = 1;
+    #if defined(_WIN32)
+        return _aligned_malloc(Size, Align);
+    #else
+        // aligned_alloc needs the size to be a multiple of the alignment
+        return std::aligned_alloc(Align, (Size + Align - 1) & ~(Align - 1));
+    #endif
+    }
+
+    void AlignedFree(void* p) noexcept
+    {
+    #if defined(_WIN32)
+        _aligned_free(p);
+    #else
+        std::free(p);
+    #endif
+    }
+}
+
+void* operator new(std::size_t Size)
+{
+    s_AllocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(Size ? Size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t Size)
+{
+    return ::operator new(Size);
+}
+
+void* operator new(std::size_t Size, const std::nothrow_t&) noexcept
+{
+    s_AllocationCount.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(Size ? Size : 1);
+}
+
+void* operator new[](std::size_t Size, const std::nothrow_t& Tag) noexcept
+{
+    return ::operator new(Size, Tag);
+}
+
+void* operator new(std::size_t Size, std::align_val_t Alignment)
+{
+    s_AllocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = AlignedAlloc(Size, Alignment)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t Size, std::align_val_t Alignment)
+{
+    return ::operator new(Size, Alignment);
+}
+
+void* operator new(std::size_t Size, std::align_val_t Alignment, const std::nothrow_t&) noexcept
+{
+    s_AllocationCount.fetch_add(1, std::memory_order_relaxed);
+    return AlignedAlloc(Size, Alignment);
+}
+
+void* operator new[](std::size_t Size, std::align_val_t Alignment, const std::nothrow_t& Tag) noexcept
+{
+    return ::operator new(Size, Alignment, Tag);
+}
+
+void operator delete  (void* p)                     noexcept { std::free(p); }
+void operator delete[](void* p)                     noexcept { std::free(p); }
+void operator delete  (void* p, std::size_t)        noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t)        noexcept { std::free(p); }
+
+void operator delete  (void* p, std::align_val_t)                   noexcept { AlignedFree(p); }
+void operator delete[](void* p, std::align_val_t)                   noexcept { AlignedFree(p); }
+void operator delete  (void* p, std::size_t, std::align_val_t)      noexcept { AlignedFree(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t)      noexcept { AlignedFree(p); }
+
+//------------------------------------------------------------------------------------
+
+namespace xgeom_static_compiler::profiler
+{
+    namespace
+    {
+        struct event
+        {
+            const char*     m_pName;
+            std::uint64_t   m_StartUS;
+            std::uint64_t   m_DurationUS;
+            std::uint64_t   m_CPUUS;
+            std::uint64_t   m_Allocations;
+            std::uint64_t   m_PeakRSS;
+            std::uint64_t   m_ThreadID;
+        };
+
+        // Events are kept per thread so the batch mode can compile several descriptors at
+        // the same time, each one gets the trace of its own stages. Allocations and peak
+        // RSS are process wide so in that case they include the other jobs.
+        thread_local std::vector<event>             s_Events;
+        const std::chrono::steady_clock::time_point s_Epoch = std::chrono::steady_clock::now();
+
+        //--------------------------------------------------------------------------------
+
+        std::uint64_t getWallUS(void) noexcept
+        {
+            return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - s_Epoch).count());
+        }
+
+        //--------------------------------------------------------------------------------
+        // User + kernel time of the whole process, so the stages that fan out to the
+        // scheduler show how much work they really did
+
+        std::uint64_t getCPUUS(void) noexcept
+        {
+        #if defined(_WIN32)
+            FILETIME Creation, Exit, Kernel, User;
+            if (not GetProcessTimes(GetCurrentProcess(), &Creation, &Exit, &Kernel, &User)) return 0;
+            auto ToUS = [](const FILETIME& T) { return ((std::uint64_t(T.dwHighDateTime) << 32) | T.dwLowDateTime) / 10; };
+            return ToUS(Kernel) + ToUS(User);
+        #else
+            rusage Usage;
+            if (getrusage(RUSAGE_SELF, &Usage)) return 0;
+            auto ToUS = [](const timeval& T) { return std::uint64_t(T.tv_sec) * 1000000 + std::uint64_t(T.tv_usec); };
+            return ToUS(Usage.ru_utime) + ToUS(Usage.ru_stime);
+        #endif
+        }
+
+        //--------------------------------------------------------------------------------
+
+        std::uint64_t getThreadID(void) noexcept
+        {
+            return static_cast<std::uint64_t>(std::hash<std::thread::id>{}(std::this_thread::get_id()) & 0xffffffff);
+        }
+    }
+
+    //------------------------------------------------------------------------------------
+
+    std::uint64_t getAllocationCount(void) noexcept
+    {
+        return s_AllocationCount.load(std::memory_order_relaxed);
+    }
+
+    //------------------------------------------------------------------------------------
+
+    std::uint64_t getPeakRSS(void) noexcept
+    {
+    #if defined(_WIN32)
+        PROCESS_MEMORY_COUNTERS Counters;
+        if (not GetProcessMemoryInfo(GetCurrentProcess(), &Counters, sizeof(Counters))) return 0;
+        return Counters.PeakWorkingSetSize;
+    #else
+        rusage Usage;
+        if (getrusage(RUSAGE_SELF, &Usage)) return 0;
+        #if defined(__APPLE__)
+        return static_cast<std::uint64_t>(Usage.ru_maxrss);
+        #else
+        return static_cast<std::uint64_t>(Usage.ru_maxrss) * 1024;
+        #endif
+    #endif
+    }
+
+    //------------------------------------------------------------------------------------
+
+    scope::scope(const char* pName) noexcept
+        : m_pName           { pName }
+        , m_StartWallUS     { getWallUS() }
+        , m_StartCPUUS      { getCPUUS() }
+        , m_StartAllocations{ getAllocationCount() }
+    {
+    }
+
+    //------------------------------------------------------------------------------------
+
+    scope::~scope(void) noexcept
+    {
+        event E;
+        E.m_pName       = m_pName;
+        E.m_StartUS     = m_StartWallUS;
+        E.m_DurationUS  = getWallUS()           - m_StartWallUS;
+        E.m_CPUUS       = getCPUUS()            - m_StartCPUUS;
+        E.m_Allocations = getAllocationCount()  - m_StartAllocations;
+        E.m_PeakRSS     = getPeakRSS();
+        E.m_ThreadID    = getThreadID();
+
+        s_Events.push_back(E);
+    }
+
+    //------------------------------------------------------------------------------------
+
+    void Reset(void) noexcept
+    {
+        s_Events.clear();
+    }
+
+    //------------------------------------------------------------------------------------
+
+    bool WriteChromeTrace(std::wstring_view Path) noexcept
+    {
+        std::ofstream File(std::filesystem::path(Path), std::ios::trunc);
+        if (not File) return false;
+
+        File << "{ \"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+        for (std::size_t i = 0; i < s_Events.size(); ++i)
+        {
+            const auto& E = s_Events[i];
+            File << std::format( "{}\n  {{ \"name\": \"{}\", \"cat\": \"compile\", \"ph\": \"X\", \"pid\": 1, \"tid\": {}, \"ts\": {}, \"dur\": {}"
+                                 ", \"args\": {{ \"cpu_ms\": {:.3f}, \"allocations\": {}, \"peak_rss_mb\": {:.2f} }} }}"
+                               , i ? "," : ""
+                               , E.m_pName
+                               , E.m_ThreadID
+                               , E.m_StartUS
+                               , E.m_DurationUS
+                               , E.m_CPUUS / 1000.0
+                               , E.m_Allocations
+                               , E.m_PeakRSS / (1024.0 * 1024.0) );
+        }
+        File << "\n] }\n";
+
+        return static_cast<bool>(File);
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef XGEOM_STATIC_COMPILER_PROFILER_H
+#define XGEOM_STATIC_COMPILER_PROFILER_H
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+//
+// Scoped instrumentation for the compile pipeline. Every scope records its wall time, the
+// process CPU time, the number of heap allocations and the peak resident memory, the results
+// can be written as a Chrome trace (chrome://tracing, Perfetto) so the stages of a compile
+// can be charted per asset.
+//
+namespace xgeom_static_compiler::profiler
+{
+    struct scope
+    {
+                                scope               (const char* pName)     noexcept;
+                               ~scope               (void)                  noexcept;
+                                scope               (const scope&)          = delete;
+        scope&                  operator =          (const scope&)          = delete;
+
+        const char*             m_pName;
+        std::uint64_t           m_StartWallUS;
+        std::uint64_t           m_StartCPUUS;
+        std::uint64_t           m_StartAllocations;
+    };
+
+    void                        Reset               (void)                  noexcept;
+    bool                        WriteChromeTrace    (std::wstring_view Path) noexcept;
+    std::uint64_t               getAllocationCount  (void)                  noexcept;
+    std::uint64_t               getPeakRSS          (void)                  noexcept;
+}
+
+#endif
@@ -5,32 +5,39 @@
 #include "dependencies/xmath/source/xmath_fshapes.h"
 #include "dependencies/xserializer/source/xserializer.h"
 #include <span>  // Add for std::span
+#include <limits>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <cassert>
+#include <filesystem>
+#include <format>
 
 namespace xgeom_static
 {
     struct geom
     {
-        inline static constexpr auto xserializer_version_v = 1;
+        inline static constexpr auto xserializer_version_v = 7;     // 5: 32 bit lod/submesh/cluster counters, 6: shared payloads, 7: instances
         struct mesh
         {
             std::array<char, 32>    m_Name;
             float                   m_WorldPixelSize;   // Average World Pixel size for this SubMesh
             xmath::fbbox            m_BBox;
             std::uint16_t           m_nLODs;
-            std::uint16_t           m_iLOD;
+            std::uint32_t           m_iLOD;
         };
 
         struct lod
         {
             float                   m_ScreenArea;
-            std::uint16_t           m_iSubmesh;         // Start the submeshes
-            std::uint16_t           m_nSubmesh;
+            std::uint32_t           m_iSubmesh;         // Start the submeshes
+            std::uint32_t           m_nSubmesh;
         };
 
         struct submesh
         {
-            std::uint16_t           m_iCluster;         // Where the index starts
-            std::uint16_t           m_nCluster;         // Where the index starts
+            std::uint32_t           m_iCluster;         // Where the index starts
+            std::uint32_t           m_nCluster;         // Where the index starts
             std::uint16_t           m_iMaterial;        // Index of the Material that this SubMesh uses
         };
 
@@ -59,12 +66,32 @@ namespace xgeom_static
         struct cluster
         {
             xmath::fbbox            m_BBox;                     // Optional fine-grained CPU culling (e.g., per-cluster frustum/occlusion)
+            vec4                    m_BoundingSphere;           // XYZ = center, W = radius
+            vec4                    m_ConeAxisCutoff;           // XYZ = normal cone axis, W = cos of the cone cutoff (>= 1 disables cone culling)
+            vec3                    m_ConeApex;                 // Apex of the normal cone (backface culling: dot(normalize(Apex - Eye), Axis) >= Cutoff)
             std::uint32_t           m_iIndex;                   // Where the index starts
             std::uint32_t           m_nIndices;                 // number of
             std::uint32_t           m_iVertex;                  // Where the vertex starts
             std::uint32_t           m_nVertices;                // number of
         };
 
+        struct cluster_lod
+        {
+            vec4                    m_Sphere;                   // Bounds of the group the cluster was built from (XYZ = center, W = radius)
+            vec4                    m_ParentSphere;             // Bounds of the group the cluster was simplified into
+            float                   m_Error;                    // Object space error of the cluster (0 for full detail)
+            float                   m_ParentError;              // Error of its simplified version (max float when it has none)
+        };
+
+        // Extra placement of a mesh. The mesh is drawn as is and once more per instance with the
+        // transform applied to its vertices (which are stored at the placement of the first copy).
+        // The table is sorted by m_iMesh, renderers draw every placement with ForEachMeshPlacement.
+        struct instance
+        {
+            std::array<vec4, 3>     m_Transform;                // Rows of a 3x4 affine transform (W = translation)
+            std::uint16_t           m_iMesh;
+        };
+
         struct vertex
         {
             int16_t m_XPos, m_YPos, m_ZPos;
@@ -80,6 +107,32 @@ namespace xgeom_static
 
         using runtime_allocation = std::array<std::size_t, 4*(sizeof(std::shared_ptr<int>) / sizeof(std::size_t))>;
 
+        // m_pData holds the meshopt encoded streams instead of the final layout. The encoded
+        // layout is: a table with the encoded byte size of the static and extras streams of
+        // every vertex range (see ForEachVertexRange) followed by the encoded byte size of the
+        // indices of every cluster (all as std::uint32_t), then all the encoded streams in that
+        // same order and finally the raw cluster_data. Decoding produces the regular layout
+        // (m_DecodedDataSize bytes) described by the m_*Offset members.
+        inline static constexpr std::uint8_t flags_encoded_data_v = 1 << 0;
+
+        // The index buffer holds std::uint32_t instead of std::uint16_t. Only set when a cluster
+        // was allowed to go over 65535 vertices (see cluster_settings::m_bWideIndices), the
+        // indices are still relative to cluster::m_iVertex.
+        inline static constexpr std::uint8_t flags_index32_v      = 1 << 1;
+
+        // The clusters, cluster LODs and m_pData live in a shared payload file (a geom with only
+        // those) named after m_PayloadHash, see getPayloadPath. Assets that compile to the same
+        // payload store it once and the loader shares one set of GPU buffers between them.
+        inline static constexpr std::uint8_t flags_shared_payload_v = 1 << 2;
+
+        // Runtime only, never written by the compiler. The loader owns m_pData (it replaced the
+        // encoded streams with a decoded copy) and must delete[] it when the geom goes away.
+        inline static constexpr std::uint8_t flags_loader_owns_data_v = 1 << 7;
+
+        // The payload store sits in a Payloads folder next to the first ancestor of the resource
+        // named like the resource type folder (the resource folder itself when there is none)
+        inline static constexpr auto         payload_root_folder_v  = L"GeomStatic";
+
         //-------------------------------------------------------------------------
 
                                                         geom                        (void)                                      noexcept = default;
@@ -94,9 +147,21 @@ namespace xgeom_static
         inline std::span<cluster>                       getClusters                 (void)                              const   noexcept { return { m_pCluster, m_nClusters }; }
         inline std::span<vertex>                        getVertices                 (void)                              const   noexcept { return { reinterpret_cast<vertex*>       (m_pData + m_VertexOffset),         m_nVertices }; }
         inline std::span<vertex_extras>                 getVertexExtras             (void)                              const   noexcept { return { reinterpret_cast<vertex_extras*>(m_pData + m_VertexExtrasOffset),   m_nVertices }; }
-        inline std::span<std::uint16_t>                 getIndices                  (void)                              const   noexcept { return { reinterpret_cast<std::uint16_t*>(m_pData + m_IndicesOffset),        m_nIndices  }; }
+        inline std::span<std::uint16_t>                 getIndices                  (void)                              const   noexcept { assert(getIndexSize() == sizeof(std::uint16_t)); return { reinterpret_cast<std::uint16_t*>(m_pData + m_IndicesOffset), m_nIndices }; }
+        inline std::span<std::uint32_t>                 getIndices32                (void)                              const   noexcept { assert(getIndexSize() == sizeof(std::uint32_t)); return { reinterpret_cast<std::uint32_t*>(m_pData + m_IndicesOffset), m_nIndices }; }
+        inline std::size_t                              getIndexSize                (void)                              const   noexcept { return (m_Flags & flags_index32_v) ? sizeof(std::uint32_t) : sizeof(std::uint16_t); }
         inline std::span<cluster_data>                  getClusterData              (void)                              const   noexcept { return { reinterpret_cast<cluster_data*> (m_pData + m_ClusterDataOffset),    m_nClusters }; }
         inline std::span<xrsc::material_instance_ref>   getDefaultMaterialInstances (void)                              const   noexcept { return { m_pDefaultMaterialInstances, m_nDefaultMaterialInstances }; }
+        inline std::span<cluster_lod>                   getClusterLODs              (void)                              const   noexcept { return { m_pClusterLOD, m_nClusterLODs }; }
+        inline std::span<instance>                      getInstances                (void)                              const   noexcept { return { m_pInstance, m_nInstances }; }
+        inline std::span<instance>                      getMeshInstances            (int iMesh)                         const   noexcept;
+        template<typename T_FUNCTION>
+        inline void                                     ForEachMeshPlacement        (int iMesh, T_FUNCTION&& Function)  const   noexcept;
+        inline static std::filesystem::path             getPayloadPath              (const std::filesystem::path& ResourcePath, std::uint64_t PayloadHash) noexcept;
+        template<typename T_FUNCTION>
+        inline void                                     ForEachVertexRange          (T_FUNCTION&& Function)             const   noexcept;
+        template<typename T_FUNCTION>
+        inline void                                     SelectClusterCut            (const submesh& Submesh, const xmath::fvec3& EyePos, float ProjectionScale, float PixelError, T_FUNCTION&& Function) const noexcept;
 
         xmath::fbbox                    m_BBox;
         char*                           m_pData;  // Contiguous buffer for GPU data ( vertices, extras, indices)
@@ -104,6 +169,8 @@ namespace xgeom_static
         lod*                            m_pLOD;
         submesh*                        m_pSubMesh;
         cluster*                        m_pCluster;
+        cluster_lod*                    m_pClusterLOD;  // Optional, one per cluster when the geom was compiled as a cluster DAG
+        instance*                       m_pInstance;    // Optional, repeated meshes detected by the compiler
         xrsc::material_instance_ref*    m_pDefaultMaterialInstances;
         runtime_allocation              m_RunTimeSpace;
         std::size_t                     m_DataSize;
@@ -111,13 +178,18 @@ namespace xgeom_static
         std::size_t                     m_VertexExtrasOffset;
         std::size_t                     m_IndicesOffset;
         std::size_t                     m_ClusterDataOffset;
+        std::size_t                     m_DecodedDataSize;
         std::uint16_t                   m_nMeshes;
-        std::uint16_t                   m_nLODs;
-        std::uint16_t                   m_nSubMeshs;
-        std::uint16_t                   m_nClusters;
+        std::uint32_t                   m_nLODs;
+        std::uint32_t                   m_nSubMeshs;
+        std::uint32_t                   m_nClusters;
+        std::uint32_t                   m_nClusterLODs;
+        std::uint32_t                   m_nInstances;
         std::uint32_t                   m_nIndices;
         std::uint32_t                   m_nVertices;
+        std::uint64_t                   m_PayloadHash;  // Only with flags_shared_payload_v
         std::uint16_t                   m_nDefaultMaterialInstances;
+        std::uint8_t                    m_Flags;
     };
 
     //-------------------------------------------------------------------------
@@ -141,6 +213,8 @@ namespace xgeom_static
         if (m_pLOD)                         delete[] m_pLOD;
         if (m_pSubMesh)                     delete[] m_pSubMesh;
         if (m_pCluster)                     delete[] m_pCluster;
+        if (m_pClusterLOD)                  delete[] m_pClusterLOD;
+        if (m_pInstance)                    delete[] m_pInstance;
         if (m_pDefaultMaterialInstances)    delete[] m_pDefaultMaterialInstances;
         if (m_pData)                        delete[] m_pData;
 
@@ -161,6 +235,102 @@ namespace xgeom_static
         }
         return -1;
     }
+
+    //-------------------------------------------------------------------------
+
+    std::filesystem::path geom::getPayloadPath(const std::filesystem::path& ResourcePath, std::uint64_t PayloadHash) noexcept
+    {
+        auto Root = ResourcePath.parent_path();
+        for (auto P = Root; P.has_relative_path(); P = P.parent_path())
+        {
+            if (P.filename() == payload_root_folder_v)
+            {
+                Root = P;
+                break;
+            }
+        }
+
+        return Root / L"Payloads" / std::format(L"{:016x}.payload", PayloadHash);
+    }
+
+    //-------------------------------------------------------------------------
+    // Instances of a mesh, the table is sorted by mesh so they are one range
+
+    std::span<geom::instance> geom::getMeshInstances(int iMesh) const noexcept
+    {
+        auto* const pBegin = std::partition_point(m_pInstance, m_pInstance + m_nInstances, [&](const instance& I) { return I.m_iMesh < iMesh; });
+        auto* const pEnd   = std::partition_point(pBegin,      m_pInstance + m_nInstances, [&](const instance& I) { return I.m_iMesh == iMesh; });
+        return { pBegin, pEnd };
+    }
+
+    //-------------------------------------------------------------------------
+    // Calls Function(pTransform) for every placement of a mesh: once with nullptr for the
+    // vertices as stored and once per instance with its 3x4 transform (rows, W = translation).
+    // The draw path multiplies its local to world by the transform (when there is one) and
+    // draws the clusters of the mesh again, geoms without instances draw once as before.
+
+    template<typename T_FUNCTION>
+    void geom::ForEachMeshPlacement(int iMesh, T_FUNCTION&& Function) const noexcept
+    {
+        Function(static_cast<const std::array<vec4, 3>*>(nullptr));
+        for (const auto& I : getMeshInstances(iMesh))
+            Function(&I.m_Transform);
+    }
+
+    //-------------------------------------------------------------------------
+    // Calls Function(iVertex, nVertices) for every distinct vertex range used by the clusters
+    // in vertex order. Clusters may share a vertex range (index-only LOD clusters) but the
+    // distinct ranges never overlap and together cover all the vertices.
+
+    template<typename T_FUNCTION>
+    void geom::ForEachVertexRange(T_FUNCTION&& Function) const noexcept
+    {
+        std::vector<std::pair<std::uint32_t, std::uint32_t>> Ranges;
+        Ranges.reserve(m_nClusters);
+        for (const auto& C : getClusters()) Ranges.emplace_back(C.m_iVertex, C.m_nVertices);
+
+        std::sort(Ranges.begin(), Ranges.end());
+        Ranges.erase(std::unique(Ranges.begin(), Ranges.end()), Ranges.end());
+
+        for (const auto& [iVertex, nVertices] : Ranges)
+            Function(iVertex, nVertices);
+    }
+
+    //-------------------------------------------------------------------------
+    // Calls Function(iCluster) for every cluster of the submesh that belongs to the cut of the
+    // cluster DAG for the given view. A cluster is picked when its own error is small enough
+    // on screen but the error of its parent is not. Siblings share the same parent bounds so
+    // they are always picked together and the cut has no cracks.
+    // ProjectionScale is ViewportHeight / (2 * tan(FovY / 2)), PixelError the allowed error in
+    // pixels. Geoms without cluster LOD data report every cluster of the submesh.
+
+    template<typename T_FUNCTION>
+    void geom::SelectClusterCut(const submesh& Submesh, const xmath::fvec3& EyePos, float ProjectionScale, float PixelError, T_FUNCTION&& Function) const noexcept
+    {
+        auto ProjectedError = [&](const vec4& Sphere, float Error) noexcept
+        {
+            if (Error == std::numeric_limits<float>::max()) return Error;
+
+            const float dx   = Sphere.m_X - EyePos.m_X;
+            const float dy   = Sphere.m_Y - EyePos.m_Y;
+            const float dz   = Sphere.m_Z - EyePos.m_Z;
+            const float Dist = std::max(std::sqrt(dx * dx + dy * dy + dz * dz) - Sphere.m_W, 1e-6f);
+            return Error * ProjectionScale / Dist;
+        };
+
+        for (std::uint32_t i = Submesh.m_iCluster, end = Submesh.m_iCluster + Submesh.m_nCluster; i < end; ++i)
+        {
+            if (m_nClusterLODs == 0)
+            {
+                Function(i);
+                continue;
+            }
+
+            const auto& L = m_pClusterLOD[i];
+            if (ProjectedError(L.m_Sphere, L.m_Error) <= PixelError && ProjectedError(L.m_ParentSphere, L.m_ParentError) > PixelError)
+                Function(i);
+        }
+    }
 }
 
 //-------------------------------------------------------------------------
@@ -230,6 +400,60 @@ namespace xserializer::io_functions
             || (Err = Stream.Serialize(Cluster.m_BBox.m_Max.m_X))
             || (Err = Stream.Serialize(Cluster.m_BBox.m_Max.m_Y))
             || (Err = Stream.Serialize(Cluster.m_BBox.m_Max.m_Z))
+            || (Err = Stream.Serialize(Cluster.m_BoundingSphere.m_X))
+            || (Err = Stream.Serialize(Cluster.m_BoundingSphere.m_Y))
+            || (Err = Stream.Serialize(Cluster.m_BoundingSphere.m_Z))
+            || (Err = Stream.Serialize(Cluster.m_BoundingSphere.m_W))
+            || (Err = Stream.Serialize(Cluster.m_ConeAxisCutoff.m_X))
+            || (Err = Stream.Serialize(Cluster.m_ConeAxisCutoff.m_Y))
+            || (Err = Stream.Serialize(Cluster.m_ConeAxisCutoff.m_Z))
+            || (Err = Stream.Serialize(Cluster.m_ConeAxisCutoff.m_W))
+            || (Err = Stream.Serialize(Cluster.m_ConeApex.m_X))
+            || (Err = Stream.Serialize(Cluster.m_ConeApex.m_Y))
+            || (Err = Stream.Serialize(Cluster.m_ConeApex.m_Z))
+            ;
+        return Err;
+    }
+
+    //-------------------------------------------------------------------------
+    template<> inline
+    xerr SerializeIO<xgeom_static::geom::cluster_lod>(xserializer::stream& Stream, const xgeom_static::geom::cluster_lod& ClusterLOD) noexcept
+    {
+        xerr Err;
+        false
+            || (Err = Stream.Serialize(ClusterLOD.m_Sphere.m_X))
+            || (Err = Stream.Serialize(ClusterLOD.m_Sphere.m_Y))
+            || (Err = Stream.Serialize(ClusterLOD.m_Sphere.m_Z))
+            || (Err = Stream.Serialize(ClusterLOD.m_Sphere.m_W))
+            || (Err = Stream.Serialize(ClusterLOD.m_ParentSphere.m_X))
+            || (Err = Stream.Serialize(ClusterLOD.m_ParentSphere.m_Y))
+            || (Err = Stream.Serialize(ClusterLOD.m_ParentSphere.m_Z))
+            || (Err = Stream.Serialize(ClusterLOD.m_ParentSphere.m_W))
+            || (Err = Stream.Serialize(ClusterLOD.m_Error))
+            || (Err = Stream.Serialize(ClusterLOD.m_ParentError))
+            ;
+        return Err;
+    }
+
+    //-------------------------------------------------------------------------
+    template<> inline
+    xerr SerializeIO<xgeom_static::geom::instance>(xserializer::stream& Stream, const xgeom_static::geom::instance& Instance) noexcept
+    {
+        xerr Err;
+        false
+            || (Err = Stream.Serialize(Instance.m_Transform[0].m_X))
+            || (Err = Stream.Serialize(Instance.m_Transform[0].m_Y))
+            || (Err = Stream.Serialize(Instance.m_Transform[0].m_Z))
+            || (Err = Stream.Serialize(Instance.m_Transform[0].m_W))
+            || (Err = Stream.Serialize(Instance.m_Transform[1].m_X))
+            || (Err = Stream.Serialize(Instance.m_Transform[1].m_Y))
+            || (Err = Stream.Serialize(Instance.m_Transform[1].m_Z))
+            || (Err = Stream.Serialize(Instance.m_Transform[1].m_W))
+            || (Err = Stream.Serialize(Instance.m_Transform[2].m_X))
+            || (Err = Stream.Serialize(Instance.m_Transform[2].m_Y))
+            || (Err = Stream.Serialize(Instance.m_Transform[2].m_Z))
+            || (Err = Stream.Serialize(Instance.m_Transform[2].m_W))
+            || (Err = Stream.Serialize(Instance.m_iMesh))
             ;
         return Err;
     }
@@ -255,6 +479,10 @@ namespace xserializer::io_functions
             || (Err = Stream.Serialize(Geom.m_pSubMesh,                     Geom.m_nSubMeshs))
             || (Err = Stream.Serialize(Geom.m_nClusters))
             || (Err = Stream.Serialize(Geom.m_pCluster,                     Geom.m_nClusters))
+            || (Err = Stream.Serialize(Geom.m_nClusterLODs))
+            || (Err = Stream.Serialize(Geom.m_pClusterLOD,                  Geom.m_nClusterLODs))
+            || (Err = Stream.Serialize(Geom.m_nInstances))
+            || (Err = Stream.Serialize(Geom.m_pInstance,                    Geom.m_nInstances))
             || (Err = Stream.Serialize(Geom.m_nDefaultMaterialInstances))
             || (Err = Stream.Serialize(Geom.m_pDefaultMaterialInstances,    Geom.m_nDefaultMaterialInstances))
             || (Err = Stream.Serialize(Geom.m_DataSize))
@@ -272,6 +500,9 @@ namespace xserializer::io_functions
             || (Err = Stream.Serialize(Geom.m_ClusterDataOffset))
             || (Err = Stream.Serialize(Geom.m_nVertices))
             || (Err = Stream.Serialize(Geom.m_nIndices))
+            || (Err = Stream.Serialize(Geom.m_DecodedDataSize))
+            || (Err = Stream.Serialize(Geom.m_Flags))
+            || (Err = Stream.Serialize(Geom.m_PayloadHash))
             ;
         return Err;
     }
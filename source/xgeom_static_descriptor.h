@@ -43,15 +43,96 @@ namespace xgeom_static
     {
         std::string                 m_Name = {};
         std::vector<lod>            m_LODs = {};
+        float                       m_Precision = 0;    // Position quantization step in world units, 0 = derived from the mesh
 
         XPROPERTY_DEF
         ( "mesh_details", mesh_details
         , obj_member<"Name", &mesh_details::m_Name >
         , obj_member<"LODs", &mesh_details::m_LODs >
+        , obj_member<"Precision", &mesh_details::m_Precision >
         )
     };
     XPROPERTY_REG(mesh_details)
 
+    enum class cluster_mode : std::uint8_t
+    { EXTENT_SPLIT                      // Clusters as big as the quantization range and 16 bit indices allow
+    , MESHLETS                          // Fixed budget meshlets (meshopt_buildMeshlets) with sphere/cone culling bounds
+    , CLUSTER_DAG                       // Meshlets plus a hierarchy of simplified cluster groups for continuous LOD
+    };
+
+    inline static constexpr auto cluster_mode_list_v = std::array
+    { xproperty::settings::enum_item{ "EXTENT_SPLIT",   cluster_mode::EXTENT_SPLIT }
+    , xproperty::settings::enum_item{ "MESHLETS",       cluster_mode::MESHLETS }
+    , xproperty::settings::enum_item{ "CLUSTER_DAG",    cluster_mode::CLUSTER_DAG }
+    };
+
+    enum class cluster_partition : std::uint8_t
+    { MIDPOINT                          // Split at the middle of the largest extent
+    , MEDIAN                            // Split at the median centroid, balanced triangle counts
+    , SAH                               // Binned surface area heuristic over the position axes
+    };
+
+    inline static constexpr auto cluster_partition_list_v = std::array
+    { xproperty::settings::enum_item{ "MIDPOINT",       cluster_partition::MIDPOINT }
+    , xproperty::settings::enum_item{ "MEDIAN",         cluster_partition::MEDIAN }
+    , xproperty::settings::enum_item{ "SAH",            cluster_partition::SAH }
+    };
+
+    struct cluster_settings
+    {
+        cluster_mode        m_Mode                  = cluster_mode::EXTENT_SPLIT;
+        cluster_partition   m_Partition             = cluster_partition::MIDPOINT;
+        bool                m_bMergeClusters        = false;     // Merge neighbor leaves while they fit the quantization and vertex budgets
+        bool                m_bShareLODVertices     = false;     // Coarse LODs become index-only clusters over the LOD0 vertices when possible
+        bool                m_bWeldVertices         = true;      // Collapse vertices that are identical, or quantize to the same values inside a cluster
+        bool                m_bWideIndices          = false;     // Extent split clusters may go over 65535 vertices instead of splitting, the geom then uses 32 bit indices
+        bool                m_bAdaptivePrecision    = false;     // Position precision derived per mesh from its average edge length instead of a fixed 1 mm (UVs keep their fixed range)
+        bool                m_bCompactPositions     = false;     // Clusters smaller than the 16 bit range quantize at the mesh precision, fewer bits for the encoded payload
+        int                 m_MeshletMaxVertices    = 64;
+        int                 m_MeshletMaxTriangles   = 124;       // Must be a multiple of 4
+        float               m_MeshletConeWeight     = 0.25f;     // 0 = best spatial locality, 1 = best cone culling
+
+        XPROPERTY_DEF
+        ( "clusterSettings", cluster_settings
+        , obj_member<"Mode",                    &cluster_settings::m_Mode, member_enum_span<cluster_mode_list_v> >
+        , obj_member<"Partition",               &cluster_settings::m_Partition, member_enum_span<cluster_partition_list_v> >
+        , obj_member<"MergeClusters",           &cluster_settings::m_bMergeClusters >
+        , obj_member<"ShareLODVertices",        &cluster_settings::m_bShareLODVertices >
+        , obj_member<"WeldVertices",            &cluster_settings::m_bWeldVertices >
+        , obj_member<"AdaptivePrecision",       &cluster_settings::m_bAdaptivePrecision >
+        , obj_member<"CompactPositions",        &cluster_settings::m_bCompactPositions >
+        , obj_member<"WideIndices",             &cluster_settings::m_bWideIndices, member_dynamic_flags < +[](const cluster_settings& O)
+        {
+            xproperty::flags::type Flags = {};
+            Flags.m_bDontShow = O.m_Mode != cluster_mode::EXTENT_SPLIT;
+            return Flags;
+        }
+        >>
+        , obj_member<"MeshletMaxVertices",      &cluster_settings::m_MeshletMaxVertices, member_dynamic_flags < +[](const cluster_settings& O)
+        {
+            xproperty::flags::type Flags = {};
+            Flags.m_bDontShow = O.m_Mode == cluster_mode::EXTENT_SPLIT;
+            return Flags;
+        }
+        >>
+        , obj_member<"MeshletMaxTriangles",     &cluster_settings::m_MeshletMaxTriangles, member_dynamic_flags < +[](const cluster_settings& O)
+        {
+            xproperty::flags::type Flags = {};
+            Flags.m_bDontShow = O.m_Mode == cluster_mode::EXTENT_SPLIT;
+            return Flags;
+        }
+        >>
+        , obj_member<"MeshletConeWeight",       &cluster_settings::m_MeshletConeWeight, member_dynamic_flags < +[](const cluster_settings& O)
+        {
+            xproperty::flags::type Flags = {};
+            Flags.m_bDontShow = O.m_Mode == cluster_mode::EXTENT_SPLIT;
+            return Flags;
+        }
+        >>
+        )
+    };
+    XPROPERTY_REG(cluster_settings)
+
     using node_path = std::string;
 
     struct ungroup_mesh
@@ -172,6 +253,54 @@ namespace xgeom_static
                 Errors.push_back(std::format("You have forgotten to fill the ImportMesh field which is required"));
             }
 
+            //
+            // Make sure the meshlet budget is something meshoptimizer can handle
+            //
+            if ( m_ClusterSettings.m_Mode != cluster_mode::EXTENT_SPLIT )
+            {
+                if ( m_ClusterSettings.m_MeshletMaxVertices < 3 || m_ClusterSettings.m_MeshletMaxVertices > 256 )
+                {
+                    Errors.push_back(std::format("MeshletMaxVertices must be between 3 and 256 (found {})", m_ClusterSettings.m_MeshletMaxVertices));
+                }
+
+                if ( m_ClusterSettings.m_MeshletMaxTriangles < 4 || m_ClusterSettings.m_MeshletMaxTriangles > 512 || (m_ClusterSettings.m_MeshletMaxTriangles % 4) != 0 )
+                {
+                    Errors.push_back(std::format("MeshletMaxTriangles must be a multiple of 4 between 4 and 512 (found {})", m_ClusterSettings.m_MeshletMaxTriangles));
+                }
+
+                if ( m_ClusterSettings.m_MeshletConeWeight < 0 || m_ClusterSettings.m_MeshletConeWeight > 1 )
+                {
+                    Errors.push_back(std::format("MeshletConeWeight must be between 0 and 1 (found {})", m_ClusterSettings.m_MeshletConeWeight));
+                }
+            }
+
+            //
+            // Zero disables the streaming mode
+            //
+            if ( m_MemoryBudgetMB < 0 )
+            {
+                Errors.push_back(std::format("MemoryBudgetMB can not be negative (found {})", m_MemoryBudgetMB));
+            }
+
+            //
+            // Zero means the precision is derived from the mesh
+            //
+            for ( auto& Group : m_MergeGroupList )
+            {
+                if ( Group.m_MeshDetails.m_Precision < 0 )
+                {
+                    Errors.push_back(std::format("The precision of mesh {} can not be negative (found {})", Group.m_MeshDetails.m_Name, Group.m_MeshDetails.m_Precision));
+                }
+            }
+
+            for ( auto& Ungroup : m_UngroupMeshList )
+            {
+                if ( Ungroup.m_MeshDetails.m_Precision < 0 )
+                {
+                    Errors.push_back(std::format("The precision of mesh {} can not be negative (found {})", Ungroup.m_MeshDetails.m_Name, Ungroup.m_MeshDetails.m_Precision));
+                }
+            }
+
             //
             // Make sure all the group have valid names
             //
@@ -509,11 +638,18 @@ namespace xgeom_static
         pre_transform                               m_PreTranslation        = {};
         bool                                        m_bMergeAllMeshes       = true;
         mesh_details                                m_AllMeshesDetails      = {};
+        bool                                        m_bDetectInstances      = false;    // With bMergeAllMeshes repeated meshes are kept once plus an instance transform table, the renderer must draw them (geom::ForEachMeshPlacement)
         std::vector<material_details>               m_MaterialDetailsList   = {};
         std::vector<xrsc::material_instance_ref>    m_MaterialInstRefList   = {};
         std::vector<ungroup_mesh>                   m_UngroupMeshList       = {};
         std::vector<merge_group>                    m_MergeGroupList        = {};
         std::vector<delete_entry>                   m_DeleteEntryList       = {};
+        cluster_settings                            m_ClusterSettings       = {};
+        bool                                        m_bEncodePayload        = true;     // meshopt vertex/index codec for the GPU data
+        bool                                        m_bMeshCache            = true;     // Reuse the clusters of the meshes that did not change
+        bool                                        m_bWriteStatsReport     = false;    // Vertex cache/fetch/overdraw analysis in Stats.json
+        int                                         m_MemoryBudgetMB        = 0;        // Streams the clustering through disk when not zero. Bounds the clustering working set only: the import is not out-of-core, the final geom is built in memory and ShareLODVertices disables the chunking
+        bool                                        m_bSharedPayload        = false;    // Identical compiled payloads are stored once (GeomStatic/Payloads) and shared
 
         XPROPERTY_VDEF
         ( "GeomStatic", descriptor
@@ -527,6 +663,13 @@ namespace xgeom_static
                 return Flags;
             }
             >>
+            , obj_member<"bDetectInstances",    &descriptor::m_bDetectInstances, member_dynamic_flags < +[](const descriptor& O)
+            {
+                xproperty::flags::type Flags = {};
+                Flags.m_bDontShow = !O.m_bMergeAllMeshes;
+                return Flags;
+            }
+            >>
             , obj_member < "Merge Group List", &descriptor::m_MergeGroupList, member_dynamic_flags < +[](const descriptor& O)
             {
                 xproperty::flags::type Flags = {};
@@ -544,6 +687,12 @@ namespace xgeom_static
             , obj_member<"Deleted List", &descriptor::m_DeleteEntryList >
             , obj_member<"MaterialDetailsList", &descriptor::m_MaterialDetailsList, member_flags<flags::DONT_SHOW>>
             , obj_member<"MaterialInstance", &descriptor::m_MaterialInstRefList, member_ui_open<true> >
+            , obj_member<"ClusterSettings", &descriptor::m_ClusterSettings >
+            , obj_member<"bEncodePayload", &descriptor::m_bEncodePayload >
+            , obj_member<"bMeshCache", &descriptor::m_bMeshCache >
+            , obj_member<"bWriteStatsReport", &descriptor::m_bWriteStatsReport >
+            , obj_member<"MemoryBudgetMB", &descriptor::m_MemoryBudgetMB >
+            , obj_member<"bSharedPayload", &descriptor::m_bSharedPayload >
         )
     };
     XPROPERTY_VREG(descriptor)
@@ -2,6 +2,11 @@
 #include "xgeom_static_xgpu_rsc_loader.h"
 
 #include "dependencies/xresource_guid/source/bridges/xresource_xproperty_bridge.h"
+#include "dependencies/meshoptimizer/src/meshoptimizer.h"
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
 //
 // We will register the loader, the properties, 
@@ -27,6 +32,267 @@ std::size_t MakeMuultipleOf64(const T& X)
     return MultipleOf64(s * X.size())/ s;
 }
 
+//------------------------------------------------------------------
+// Checks that the encoded table, the streams and the clusters stay inside the buffers before
+// anything is decoded, a truncated or corrupted file must fail the load and not the process.
+
+static
+bool ValidateEncodedPayload(const xgeom_static::geom& Geom, std::size_t nRanges)
+{
+    using geom = xgeom_static::geom;
+
+    const std::uint64_t IndexSize   = Geom.getIndexSize();
+    const std::uint64_t TableSize   = (std::uint64_t(nRanges) * 2 + Geom.m_nClusters) * sizeof(std::uint32_t);
+    const std::uint64_t ClusterData = std::uint64_t(Geom.m_nClusters) * sizeof(geom::cluster_data);
+
+    // Decoded layout
+    if (   Geom.m_VertexOffset       + std::uint64_t(Geom.m_nVertices) * sizeof(geom::vertex)        > Geom.m_DecodedDataSize
+        || Geom.m_VertexExtrasOffset + std::uint64_t(Geom.m_nVertices) * sizeof(geom::vertex_extras) > Geom.m_DecodedDataSize
+        || Geom.m_IndicesOffset      + std::uint64_t(Geom.m_nIndices)  * IndexSize                   > Geom.m_DecodedDataSize
+        || Geom.m_ClusterDataOffset  + ClusterData                                                   > Geom.m_DecodedDataSize )
+        return false;
+
+    for (const auto& C : Geom.getClusters())
+    {
+        if (   std::uint64_t(C.m_iIndex)  + C.m_nIndices  > Geom.m_nIndices
+            || std::uint64_t(C.m_iVertex) + C.m_nVertices > Geom.m_nVertices )
+            return false;
+    }
+
+    // Encoded layout, the table plus every stream plus the raw cluster data
+    if (TableSize > Geom.m_DataSize) return false;
+
+    const auto*     pSizes  = reinterpret_cast<const std::uint32_t*>(Geom.m_pData);
+    std::uint64_t   Total   = TableSize + ClusterData;
+    for (std::size_t i = 0; i < nRanges * 2 + Geom.m_nClusters; ++i) Total += pSizes[i];
+
+    return Total <= Geom.m_DataSize;
+}
+
+//------------------------------------------------------------------
+// Decodes the meshopt encoded payload into a new buffer with the regular layout. On success
+// the geom no longer reads as encoded and the loader owns the new buffer.
+
+static
+bool DecodePayload(xgeom_static::geom& Geom)
+{
+    const auto  nRanges     = [&]{ std::size_t n = 0; Geom.ForEachVertexRange([&](std::uint32_t, std::uint32_t){ ++n; }); return n; }();
+    if (not ValidateEncodedPayload(Geom, nRanges))
+        return false;
+
+    char*       pDecoded    = new char[Geom.m_DecodedDataSize];
+    const auto* pSizes      = reinterpret_cast<const std::uint32_t*>(Geom.m_pData);
+    const auto* pCursor     = reinterpret_cast<const unsigned char*>(Geom.m_pData) + (nRanges * 2 + Geom.m_nClusters) * sizeof(std::uint32_t);
+    int         Err         = 0;
+
+    Geom.ForEachVertexRange([&](std::uint32_t iVertex, std::uint32_t nVertices)
+    {
+        Err |= meshopt_decodeVertexBuffer(pDecoded + Geom.m_VertexOffset + iVertex * sizeof(xgeom_static::geom::vertex), nVertices, sizeof(xgeom_static::geom::vertex), pCursor, *pSizes);
+        pCursor += *pSizes++;
+
+        Err |= meshopt_decodeVertexBuffer(pDecoded + Geom.m_VertexExtrasOffset + iVertex * sizeof(xgeom_static::geom::vertex_extras), nVertices, sizeof(xgeom_static::geom::vertex_extras), pCursor, *pSizes);
+        pCursor += *pSizes++;
+    });
+
+    const auto IndexSize = Geom.getIndexSize();
+    for (const auto& C : Geom.getClusters())
+    {
+        Err |= meshopt_decodeIndexBuffer(pDecoded + Geom.m_IndicesOffset + C.m_iIndex * IndexSize, C.m_nIndices, IndexSize, pCursor, *pSizes);
+        pCursor += *pSizes++;
+    }
+
+    std::memcpy(pDecoded + Geom.m_ClusterDataOffset, pCursor, Geom.m_nClusters * sizeof(xgeom_static::geom::cluster_data));
+
+    if (Err)
+    {
+        delete[] pDecoded;
+        return false;
+    }
+
+    // The encoded data lives inside the serializer allocation so it is not freed here
+    Geom.m_pData    = pDecoded;
+    Geom.m_DataSize = Geom.m_DecodedDataSize;
+    Geom.m_Flags    = static_cast<std::uint8_t>((Geom.m_Flags & ~xgeom_static::geom::flags_encoded_data_v) | xgeom_static::geom::flags_loader_owns_data_v);
+    return true;
+}
+
+//------------------------------------------------------------------
+// Decodes the payload (when encoded) and creates the GPU buffers
+
+static void ReleaseGPUData(resource_mgr_user_data& UserData, xgeom_static::xgpu::geom& Geom);
+
+static
+bool CreateGPUData(resource_mgr_user_data& UserData, xgeom_static::xgpu::geom& Geom)
+{
+    // Decode the payload if it was compressed with the meshopt codecs
+    if (Geom.m_Flags & xgeom_static::geom::flags_encoded_data_v)
+    {
+        if (not DecodePayload(Geom))
+            return false;
+    }
+
+    // Create buffers
+    xgpu::device::error* p;
+
+    // Ideally in the future all these buffer should be a single allocation... 
+    0
+    ||(p = UserData.m_Device.Create(Geom.VertexBuffer(),       xgpu::buffer::setup{.m_Type = xgpu::buffer::type::VERTEX,  .m_EntryByteSize = (int)sizeof(xgeom_static::geom::vertex),            .m_EntryCount = (int)Geom.getVertices().size(),     .m_pData = Geom.getVertices().data()}))
+    ||(p = UserData.m_Device.Create(Geom.VertexExtrasBuffer(), xgpu::buffer::setup{.m_Type = xgpu::buffer::type::VERTEX,  .m_EntryByteSize = (int)sizeof(xgeom_static::geom::vertex_extras),     .m_EntryCount = (int)Geom.getVertexExtras().size(), .m_pData = Geom.getVertexExtras().data()}))
+    ||(p = UserData.m_Device.Create(Geom.IndexBuffer(),        xgpu::buffer::setup{.m_Type = xgpu::buffer::type::INDEX,   .m_EntryByteSize = (int)Geom.getIndexSize(),                     .m_EntryCount = (int)Geom.m_nIndices,               .m_pData = Geom.m_pData + Geom.m_IndicesOffset}))
+    ||(p = UserData.m_Device.Create(Geom.ClusterBuffer(),      xgpu::buffer::setup{.m_Type = xgpu::buffer::type::STORAGE, .m_EntryByteSize = (int)sizeof(xgeom_static::geom::cluster_data),      .m_EntryCount = (int)Geom.getClusterData().size(),  .m_pData = Geom.getClusterData().data() }))
+    ;
+
+    // Nothing half made survives, the buffers already created and the decoded data go
+    if (p)
+    {
+        ReleaseGPUData(UserData, Geom);
+        return false;
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------
+
+static
+void ReleaseGPUData(resource_mgr_user_data& UserData, xgeom_static::xgpu::geom& Geom)
+{
+    // Release all the buffers
+    UserData.m_Device.Destroy(std::move(Geom.VertexBuffer()));
+    UserData.m_Device.Destroy(std::move(Geom.VertexExtrasBuffer()));
+    UserData.m_Device.Destroy(std::move(Geom.IndexBuffer()));
+    UserData.m_Device.Destroy(std::move(Geom.ClusterBuffer()));
+
+    // The decoded payload was allocated by the loader
+    if (Geom.m_Flags & xgeom_static::geom::flags_loader_owns_data_v)
+    {
+        delete[] Geom.m_pData;
+        Geom.m_pData  = nullptr;
+        Geom.m_Flags &= ~xgeom_static::geom::flags_loader_owns_data_v;
+    }
+}
+
+//------------------------------------------------------------------
+// Shared payloads (see geom::flags_shared_payload_v). The first asset that references a
+// payload loads it and creates its GPU buffers, every other asset with the same payload hash
+// borrows them. The last one to go releases the payload.
+
+namespace
+{
+    // The global lock only guards the map and the reference counts, the disk load, decode and
+    // GPU upload of a payload run under the lock of its own entry so unrelated loads never wait
+    struct shared_payload
+    {
+        std::mutex                  m_Lock;
+        xgeom_static::xgpu::geom*   m_pGeom     = nullptr;      // Guarded by m_Lock
+        int                         m_RefCount  = 0;            // Guarded by s_PayloadLock
+    };
+
+    std::mutex                                                          s_PayloadLock;
+    std::unordered_map<std::uint64_t, std::shared_ptr<shared_payload>>  s_Payloads;
+}
+
+//------------------------------------------------------------------
+// Drops one reference, the last one takes the entry out of the map and releases the payload
+
+static
+void ReleaseSharedPayload(resource_mgr_user_data& UserData, std::uint64_t PayloadHash)
+{
+    std::shared_ptr<shared_payload> pEntry;
+    {
+        std::lock_guard Lock(s_PayloadLock);
+
+        auto It = s_Payloads.find(PayloadHash);
+        if (It == s_Payloads.end() || --It->second->m_RefCount) return;
+
+        pEntry = std::move(It->second);
+        s_Payloads.erase(It);
+    }
+
+    // Nobody else can reach the entry any more
+    if (pEntry->m_pGeom)
+    {
+        ReleaseGPUData(UserData, *pEntry->m_pGeom);
+        xserializer::default_memory_handler_v.Free(xserializer::mem_type{ .m_bUnique = true }, static_cast<xgeom_static::geom*>(pEntry->m_pGeom));
+    }
+}
+
+//------------------------------------------------------------------
+
+static
+bool AttachSharedPayload(resource_mgr_user_data& UserData, const std::wstring& ResourcePath, xgeom_static::xgpu::geom& Geom)
+{
+    // Reference the entry first so it stays alive while it loads
+    std::shared_ptr<shared_payload> pEntry;
+    {
+        std::lock_guard Lock(s_PayloadLock);
+
+        auto& Slot = s_Payloads[Geom.m_PayloadHash];
+        if (not Slot) Slot = std::make_shared<shared_payload>();
+        Slot->m_RefCount++;
+        pEntry = Slot;
+    }
+
+    std::unique_lock EntryLock(pEntry->m_Lock);
+    if (pEntry->m_pGeom == nullptr)
+    {
+        // CreateGPUData releases its own decoded data and buffers when it fails
+        xgeom_static::geom*     pPayload = nullptr;
+        xserializer::stream     Stream;
+        bool                    bOK      = not Stream.Load(xgeom_static::geom::getPayloadPath(ResourcePath, Geom.m_PayloadHash).wstring(), pPayload);
+
+        if (bOK && not CreateGPUData(UserData, *static_cast<xgeom_static::xgpu::geom*>(pPayload)))
+        {
+            xserializer::default_memory_handler_v.Free(xserializer::mem_type{ .m_bUnique = true }, pPayload);
+            bOK = false;
+        }
+
+        if (not bOK)
+        {
+            EntryLock.unlock();
+            ReleaseSharedPayload(UserData, Geom.m_PayloadHash);
+            return false;
+        }
+
+        pEntry->m_pGeom = static_cast<xgeom_static::xgpu::geom*>(pPayload);
+    }
+
+    const auto& Payload = *pEntry->m_pGeom;
+    Geom.m_pData                = Payload.m_pData;
+    Geom.m_DataSize             = Payload.m_DataSize;
+    Geom.m_DecodedDataSize      = Payload.m_DecodedDataSize;
+    Geom.m_VertexOffset         = Payload.m_VertexOffset;
+    Geom.m_VertexExtrasOffset   = Payload.m_VertexExtrasOffset;
+    Geom.m_IndicesOffset        = Payload.m_IndicesOffset;
+    Geom.m_ClusterDataOffset    = Payload.m_ClusterDataOffset;
+    Geom.m_nVertices            = Payload.m_nVertices;
+    Geom.m_nIndices             = Payload.m_nIndices;
+    Geom.m_pCluster             = Payload.m_pCluster;
+    Geom.m_nClusters            = Payload.m_nClusters;
+    Geom.m_pClusterLOD          = Payload.m_pClusterLOD;
+    Geom.m_nClusterLODs         = Payload.m_nClusterLODs;
+
+    Geom.VertexBuffer()         = pEntry->m_pGeom->VertexBuffer();
+    Geom.VertexExtrasBuffer()   = pEntry->m_pGeom->VertexExtrasBuffer();
+    Geom.IndexBuffer()          = pEntry->m_pGeom->IndexBuffer();
+    Geom.ClusterBuffer()        = pEntry->m_pGeom->ClusterBuffer();
+    return true;
+}
+
+//------------------------------------------------------------------
+
+static
+void DetachSharedPayload(resource_mgr_user_data& UserData, xgeom_static::xgpu::geom& Geom)
+{
+    // The borrowed handles go first, the buffers belong to the payload
+    Geom.VertexBuffer()         = {};
+    Geom.VertexExtrasBuffer()   = {};
+    Geom.IndexBuffer()          = {};
+    Geom.ClusterBuffer()        = {};
+
+    ReleaseSharedPayload(UserData, Geom.m_PayloadHash);
+}
+
 //------------------------------------------------------------------
 
 xresource::loader< xrsc::geom_static_type_guid_v >::data_type* xresource::loader< xrsc::geom_static_type_guid_v >::Load(xresource::mgr& Mgr, const full_guid& GUID)
@@ -39,27 +305,30 @@ xresource::loader< xrsc::geom_static_type_guid_v >::data_type* xresource::loader
     xserializer::stream Stream;
     if (auto Err = Stream.Load(Path, pGeom); Err)
     {
-        assert(false);
+        return nullptr;
     }
 
-    //
-    // Time to copy the memory to the right places
-    //
-
     // Upgrade to the runtime version
     xgeom_static::xgpu::geom* pXGPUGeom = static_cast<xgeom_static::xgpu::geom*>(pGeom);
 
-    // Create buffers
-    xgpu::device::error* p;
-
-    // Ideally in the future all these buffer should be a single allocation... 
-    0
-    ||(p = UserData.m_Device.Create(pXGPUGeom->VertexBuffer(),       xgpu::buffer::setup{.m_Type = xgpu::buffer::type::VERTEX,  .m_EntryByteSize = (int)sizeof(xgeom_static::geom::vertex),            .m_EntryCount = (int)pXGPUGeom->getVertices().size(),     .m_pData = pXGPUGeom->getVertices().data()}))
-    ||(p = UserData.m_Device.Create(pXGPUGeom->VertexExtrasBuffer(), xgpu::buffer::setup{.m_Type = xgpu::buffer::type::VERTEX,  .m_EntryByteSize = (int)sizeof(xgeom_static::geom::vertex_extras),     .m_EntryCount = (int)pXGPUGeom->getVertexExtras().size(), .m_pData = pXGPUGeom->getVertexExtras().data()}))
-    ||(p = UserData.m_Device.Create(pXGPUGeom->IndexBuffer(),        xgpu::buffer::setup{.m_Type = xgpu::buffer::type::INDEX,   .m_EntryByteSize = (int)sizeof(std::uint16_t),                         .m_EntryCount = (int)pXGPUGeom->getIndices().size(),      .m_pData = pXGPUGeom->getIndices().data()}))
-    ||(p = UserData.m_Device.Create(pXGPUGeom->ClusterBuffer(),      xgpu::buffer::setup{.m_Type = xgpu::buffer::type::STORAGE, .m_EntryByteSize = (int)sizeof(xgeom_static::geom::cluster_data),      .m_EntryCount = (int)pXGPUGeom->getClusterData().size(),  .m_pData = pXGPUGeom->getClusterData().data() }))
-    ;
-    assert(p == nullptr);
+    //
+    // Time to copy the memory to the right places
+    //
+    if (pXGPUGeom->m_Flags & xgeom_static::geom::flags_shared_payload_v)
+    {
+        // A missing or broken payload fails the load, the header alone has nothing to draw
+        if (not AttachSharedPayload(UserData, Path, *pXGPUGeom))
+        {
+            xserializer::default_memory_handler_v.Free(xserializer::mem_type{ .m_bUnique = true }, pGeom);
+            return nullptr;
+        }
+    }
+    else if (not CreateGPUData(UserData, *pXGPUGeom))
+    {
+        // A corrupted payload or a device failure fails the load like a missing shared payload
+        xserializer::default_memory_handler_v.Free(xserializer::mem_type{ .m_bUnique = true }, pGeom);
+        return nullptr;
+    }
 
     // Resolve the default material instances
     for (auto& E : pXGPUGeom->getDefaultMaterialInstances())
@@ -86,10 +355,9 @@ void xresource::loader< xrsc::geom_static_type_guid_v >::Destroy(xresource::mgr&
 {
     auto& UserData = Mgr.getUserData<resource_mgr_user_data>();
 
-    // Release all the buffers
-    UserData.m_Device.Destroy(std::move(Data.VertexBuffer()));
-    UserData.m_Device.Destroy(std::move(Data.VertexExtrasBuffer()));
-    UserData.m_Device.Destroy(std::move(Data.IndexBuffer()));
+    // Release the buffers (or our reference to the shared ones)
+    if (Data.m_Flags & xgeom_static::geom::flags_shared_payload_v) DetachSharedPayload(UserData, Data);
+    else                                                           ReleaseGPUData(UserData, Data);
 
     // Release all the material instance references
     for (auto& E : Data.getDefaultMaterialInstances())